@@ -2,9 +2,30 @@
 #define BTREE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
+#include <functional>
+#include <future>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
-#define keys node_keys()
 #define values node_values()
 #define FOUND (1u << 16u)
 #define FOUND_MASK (FOUND - 1u)
@@ -65,22 +86,273 @@ void backtrace() {
 #endif
 
 #ifdef DEBUG_MODE
-static size_t alive_node = 0;
+static std::atomic<size_t> alive_node = 0;
 #endif
 
 namespace btree {
 
-    template<typename K, typename V, bool UseBinary = true, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
+    // in-node search policies, the third parameter of BTree (`false` and `true` still select linear and binary)
+    inline constexpr unsigned LinearSearch = 0;
+    inline constexpr unsigned BinarySearch = 1;
+    inline constexpr unsigned InterpolationSearch = 2;
+
+    template<typename K, typename V, unsigned Search = BinarySearch, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
     class BTree;
 
     namespace __btree_impl {
 
-        template<typename K, typename V, bool UseBinary = true, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
+        template<typename K, typename V, unsigned Search = BinarySearch, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
         struct AbstractBTNode;
 
-        template<typename K, typename V, bool IsInternal, bool UseBinary = true, typename Compare = std::less<K>, size_t B = DEFAULT_BTREE_FACTOR>
+        template<typename K, typename V, bool IsInternal, unsigned Search = BinarySearch, typename Compare = std::less<K>, size_t B = DEFAULT_BTREE_FACTOR>
         struct alignas(64) BTreeNode;
 
+        // keys interpolation search can work with: numbers in their natural order
+        template<typename K, typename Compare>
+        constexpr bool interpolable = std::is_arithmetic_v<K> && !std::is_same_v<K, bool> &&
+                                      (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+
+        /*
+         * Lower bound of `key` in the sorted `ks[0, usage)` by interpolation: each round probes the position
+         * the key would have if the keys in the remaining range were evenly spaced. Skewed keys can make the
+         * probes creep, so after a few rounds the remaining range is left to binary search.
+         */
+        template<typename K>
+        inline uint16_t interpolation_search(const K *ks, uint16_t usage, const K &key) {
+            uint16_t lo = 0, hi = usage; // ks[0, lo) < key <= ks[hi, usage)
+            for (int round = 0; round < 4 && hi - lo > 8; ++round) {
+                if (!(ks[lo] < key)) return lo;
+                if (ks[hi - 1] < key) return hi;
+                auto fraction = (double(key) - double(ks[lo])) / (double(ks[hi - 1]) - double(ks[lo]));
+                auto probe = uint16_t(lo + uint16_t(fraction * (hi - 1 - lo)));
+                if (ks[probe] < key) {
+                    lo = probe + 1;
+                } else {
+                    hi = probe;
+                }
+            }
+            return std::lower_bound(ks + lo, ks + hi, key) - ks;
+        }
+
+        /*
+         * Open-addressing (linear probing) table from each key of a tree to the node holding it, so point
+         * lookups skip the descent. Nodes re-register the keys that moved into them whenever they are touched;
+         * erased keys are removed by the tree. Keys are hashed with std::hash, which has to agree with the
+         * equivalence of `Compare`.
+         */
+        template<typename K, typename Node, typename Compare>
+        class hash_index {
+            struct Slot {
+                Node *node = nullptr; // empty when null
+                alignas(K) unsigned char storage[sizeof(K)];
+
+                inline K &key() { return *reinterpret_cast<K *>(storage); }
+            };
+
+            Compare comp;
+            std::vector<Slot> slots;
+            size_t count = 0;
+            unsigned shift = 64;
+
+            inline size_t home(const K &key) const {
+                return size_t((uint64_t(std::hash<K>{}(key)) * 0x9e3779b97f4a7c15ull) >> shift);
+            }
+
+            inline size_t mask() const {
+                return slots.size() - 1;
+            }
+
+            // slot holding `key`, or the empty slot ending its probe sequence
+            inline size_t probe(const K &key) {
+                auto i = home(key);
+                while (slots[i].node && (comp(slots[i].key(), key) || comp(key, slots[i].key()))) {
+                    i = (i + 1) & mask();
+                }
+                return i;
+            }
+
+            void grow() {
+                auto old = std::move(slots);
+                slots = std::vector<Slot>(old.empty() ? 16 : old.size() * 2);
+                shift = 64 - std::countr_zero(slots.size());
+                for (auto &slot: old) {
+                    if (!slot.node) continue;
+                    auto i = probe(slot.key());
+                    new(slots[i].storage) K(std::move(slot.key()));
+                    slots[i].node = slot.node;
+                    std::destroy_at(&slot.key());
+                }
+            }
+
+        public:
+            hash_index(Compare comp) : comp(comp) {}
+
+            hash_index(const hash_index &) = delete;
+
+            ~hash_index() {
+                for (auto &slot: slots) {
+                    if (slot.node) std::destroy_at(&slot.key());
+                }
+            }
+
+            void reserve(size_t n) {
+                while (slots.size() * 3 < n * 4) grow();
+            }
+
+            inline Node *get(const K &key) {
+                if (slots.empty()) return nullptr;
+                return slots[probe(key)].node;
+            }
+
+            inline void assign(const K &key, Node *node) {
+                if ((count + 1) * 4 > slots.size() * 3) grow();
+                auto i = probe(key);
+                if (!slots[i].node) {
+                    new(slots[i].storage) K(key);
+                    count++;
+                }
+                slots[i].node = node;
+            }
+
+            void remove(const K &key) {
+                if (slots.empty()) return;
+                auto i = probe(key);
+                if (!slots[i].node) return;
+                std::destroy_at(&slots[i].key());
+                slots[i].node = nullptr;
+                count--;
+                // shift back the following entries whose probe sequence passed through the hole
+                for (auto j = (i + 1) & mask(); slots[j].node; j = (j + 1) & mask()) {
+                    auto h = home(slots[j].key());
+                    if (((j - h) & mask()) >= ((j - i) & mask())) {
+                        new(slots[i].storage) K(std::move(slots[j].key()));
+                        slots[i].node = slots[j].node;
+                        std::destroy_at(&slots[j].key());
+                        slots[j].node = nullptr;
+                        i = j;
+                    }
+                }
+            }
+        };
+
+        /*
+         * Blocked Bloom filter over the keys of a tree: each key sets `Probes` bits inside a single 512-bit
+         * block, so a query costs one cache line. Bits cannot be cleared, so the owner rebuilds the filter
+         * once it holds too many erased keys or more keys than it was sized for.
+         */
+        template<typename K>
+        class bloom_filter {
+            static constexpr unsigned Probes = 6;
+            std::vector<uint64_t> words;
+            size_t block_mask = 0;
+
+            static inline uint64_t mix(uint64_t h) {
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdull;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ull;
+                return h ^ (h >> 33);
+            }
+
+        public:
+            size_t capacity = 0;
+
+            bloom_filter(size_t capacity, size_t bits_per_key) : capacity(capacity) {
+                auto blocks = std::bit_ceil(std::max<size_t>(1, capacity * bits_per_key / 512));
+                words.assign(blocks * 8, 0);
+                block_mask = blocks - 1;
+            }
+
+            // the block comes from one hash word and the probes from a second one, so that no bit serves both
+            inline void add(const K &key) {
+                auto h = mix(uint64_t(std::hash<K>{}(key)));
+                auto block = words.data() + 8 * (h & block_mask);
+                h = mix(h + 0x9e3779b97f4a7c15ull);
+                for (unsigned i = 0; i < Probes; ++i, h >>= 9) {
+                    block[(h >> 6) & 7] |= uint64_t(1) << (h & 63);
+                }
+            }
+
+            inline bool may_contain(const K &key) const {
+                auto h = mix(uint64_t(std::hash<K>{}(key)));
+                auto block = words.data() + 8 * (h & block_mask);
+                h = mix(h + 0x9e3779b97f4a7c15ull);
+                for (unsigned i = 0; i < Probes; ++i, h >>= 9) {
+                    if (!(block[(h >> 6) & 7] & (uint64_t(1) << (h & 63)))) return false;
+                }
+                return true;
+            }
+        };
+
+        /*
+         * State shared by all nodes of one tree, so that tree-level accelerators holding node pointers can tell
+         * when they went stale: `epoch` counts structural changes (splits, merges, borrows) anywhere in the
+         * tree and `reroots` the replacements of the root. Changes to nodes at or above `watch_height` also
+         * widen [changed_lo, changed_hi], the key range they affected (an empty bound is unbounded). When the
+         * tree keeps a hash index, nodes register the keys moving into them in `index`.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct TreeContext {
+            Compare comp;
+            // atomic, as detached subtrees are restructured by several threads in insert_batch_parallel
+            std::atomic<size_t> epoch = 0;
+            std::atomic<size_t> reroots = 0;
+            uint8_t watch_height = UINT8_MAX;
+            bool changed = false;
+            std::optional<K> changed_lo, changed_hi;
+            hash_index<K, AbstractBTNode<K, V, Search, B, Compare>, Compare> *index = nullptr;
+            // nodes are stamped with the version they were created in; a live snapshot of version s keeps every
+            // node of version <= s from being modified in place. Snapshots are released from any thread.
+            size_t version = 0;
+            std::mutex snapshot_lock;
+            std::multiset<size_t> snapshots;
+            std::atomic<size_t> frozen_below = 0;           // nodes of a lower version may be in a snapshot
+            std::atomic<size_t> oldest_snapshot = SIZE_MAX; // or SIZE_MAX if there is none
+            // optimistic reads: readers start from `top` and announce themselves on the indicator of the current
+            // phase; nodes the writer unlinks are kept in `garbage` until every reader that might hold them left
+            bool deferred = false;
+            std::atomic<AbstractBTNode<K, V, Search, B, Compare> *> top = nullptr;
+            std::vector<AbstractBTNode<K, V, Search, B, Compare> *> garbage;
+            std::atomic<unsigned> phase = 0;
+            struct alignas(64) Indicator {
+                std::atomic<size_t> readers = 0;
+            } indicators[2];
+
+            TreeContext(Compare comp) : comp(comp) {}
+
+            ~TreeContext() {
+                for (auto node: garbage) delete node;
+            }
+
+            // free a node taken out of the tree, or keep it until the next grace period while readers may hold it
+            inline void dispose(AbstractBTNode<K, V, Search, B, Compare> *node) {
+                if (deferred) garbage.push_back(node);
+                else delete node;
+            }
+
+            // wait until every reader that entered before this call has left
+            void quiesce() {
+                auto old = phase.load();
+                auto next = old ^ 1u;
+                while (indicators[next].readers.load() != 0) std::this_thread::yield();
+                phase.store(next);
+                while (indicators[old].readers.load() != 0) std::this_thread::yield();
+            }
+
+            inline void widen(const K *lo, const K *hi) {
+                if (!changed) {
+                    changed = true;
+                    changed_lo = lo ? std::optional<K>(*lo) : std::nullopt;
+                    changed_hi = hi ? std::optional<K>(*hi) : std::nullopt;
+                    return;
+                }
+                if (!lo) changed_lo.reset();
+                else if (changed_lo && comp(*lo, *changed_lo)) changed_lo = *lo;
+                if (!hi) changed_hi.reset();
+                else if (changed_hi && comp(*changed_hi, *hi)) changed_hi = *hi;
+            }
+        };
+
         template<typename T>
         inline void uninitialized_move_back(T *start, T *end) {
             ASSERT(end >= start);
@@ -107,709 +379,3418 @@ namespace btree {
             }
         }
 
-        template<typename K, typename V, bool UseBinary, size_t B, typename Compare>
-        struct AbstractBTNode {
-
-            Compare &comp;
-
-            struct SplitResult {
-                AbstractBTNode *l, *r;
-                K key;
-                V value;
-            };
-
-            struct iterator {
-                uint16_t idx;
-                AbstractBTNode *node;
+        /*
+         * Key storage of a node, `usage` keys in order (the node keeps the count and the parallel values).
+         * Plain slots hold the keys themselves. Leaves may hold them `encoded` instead: a key is rebuilt when
+         * it is read (`get` returns it by value) and the slots answer local searches on the encoded form, as
+         * well as single comparisons (`order(i, key)`) where building the key would cost an allocation.
+         * `place` and `take` insert and remove one key, `exchange` replaces one, `fill` stores n keys into
+         * empty slots, `release` hands a key out ahead of `destroy`, and `repack` re-chooses the encoding
+         * after keys moved in or out in bulk. `each(usage, f)` calls f(i, key) for all keys in order, which
+         * is how whole nodes are read: it decodes in one pass what `get` would rebuild key by key.
+         */
+        template<typename K, size_t N>
+        struct plain_slots {
+            static constexpr bool encoded = false;
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
 
-                inline bool operator!=(const iterator &that) noexcept {
-                    return idx != that.idx || node != that.node;
-                }
+            KeyBlock blocks[N];
 
-#ifndef __cpp_lib_three_way_comparison
-                inline bool operator==(const iterator &that) noexcept {
-                    return idx == that.idx && node == that.node;
-                }
-#endif
+            plain_slots() {
+                std::memset(blocks, 0, sizeof(blocks));
+            }
 
-                iterator operator++(int) {
-                    return node->successor(idx);
-                }
+            inline K *data() {
+                return reinterpret_cast<K *>(blocks);
+            }
 
-                iterator &operator++() {
-                    auto res = node->successor(idx);
-                    this->node = res.node;
-                    this->idx = res.idx;
-                    return *this;
-                }
+            inline const K &get(size_t i) {
+                return data()[i];
+            }
 
-                std::pair<const K &, V &> operator*() {
-                    return {node->key_at(idx), node->value_at(idx)};
-                }
-            };
+            template<typename F>
+            inline void each(uint16_t usage, F f) {
+                for (uint16_t i = 0; i < usage; ++i) f(i, data()[i]);
+            }
 
-            AbstractBTNode(Compare &comp) : comp(comp) {}
+            inline K release(size_t i) {
+                return std::move(data()[i]);
+            }
 
-            virtual bool member(const K &key) = 0;
+            inline void place(uint16_t usage, uint16_t position, K key) {
+                uninitialized_move_back(data() + position, data() + usage);
+                new(data() + position) K(std::move(key));
+            }
 
-            virtual std::optional<V> insert(const K &key, const V &value, AbstractBTNode **root) = 0;
+            inline K take(uint16_t usage, uint16_t position) {
+                K key(std::move(data()[position]));
+                std::destroy_at(data() + position);
+                uninitialized_move_forward(data() + position + 1, data() + usage);
+                return key;
+            }
 
-            virtual void
-            adopt(AbstractBTNode *l, AbstractBTNode *r, K key, V value, size_t position, AbstractBTNode **root) = 0;
+            inline K exchange(uint16_t, uint16_t position, K key) {
+                std::swap(data()[position], key);
+                return key;
+            }
 
-            virtual void fix_underflow(AbstractBTNode **root) = 0;
+            template<typename Next>
+            inline void fill(uint16_t n, Next next) {
+                for (uint16_t i = 0; i < n; ++i) {
+                    new(data() + i) K(next());
+                }
+            }
 
-            virtual AbstractBTNode *&node_parent() = 0;
+            inline void copy_from(plain_slots &that, uint16_t usage) {
+                std::uninitialized_copy(that.data(), that.data() + usage, data());
+            }
 
-            virtual uint16_t &node_idx() = 0;
+            inline void destroy(uint16_t usage) {
+                std::destroy(data(), data() + usage);
+            }
 
-            virtual uint16_t &node_usage() = 0;
+            inline void repack(uint16_t) {}
+        };
 
-            virtual iterator successor(uint16_t idx) = 0;
+        /*
+         * Byte strings under std::less order like their first 8 bytes packed big-endian and zero padded: a word
+         * below another one belongs to a smaller string, while equal words are inconclusive. Nodes of string
+         * keys keep one such word per key and search by counting the words below the word of the probe, a
+         * branch-free loop the compiler vectorizes, leaving full comparisons to the keys whose word equals it.
+         */
+        static inline uint64_t string_word(std::string_view key) {
+            uint64_t word = 0;
+            std::memcpy(&word, key.data(), std::min<size_t>(key.size(), sizeof(word)));
+            if constexpr (std::endian::native == std::endian::little) {
+                return __builtin_bswap64(word);
+            } else {
+                return word;
+            }
+        }
 
-            virtual iterator predecessor(uint16_t idx) = 0;
+        // [lo, hi): the run of words equal to `probe`, all words before it being below
+        static inline std::pair<uint16_t, uint16_t> word_run(const uint64_t *words, uint16_t usage, uint64_t probe) {
+            unsigned lo = 0;
+            for (unsigned i = 0; i < usage; ++i) {
+                lo += words[i] < probe;
+            }
+            auto hi = lo;
+            while (hi < usage && words[hi] == probe) ++hi;
+            return {uint16_t(lo), uint16_t(hi)};
+        }
 
-            virtual iterator min() = 0;
+        // std::string keys of an internal node: plain, with the word of every key next to them
+        template<size_t N>
+        struct word_slots : plain_slots<std::string, N> {
+            using Base = plain_slots<std::string, N>;
 
-            virtual iterator max() = 0;
+            uint64_t words[N];
 
-            virtual K &key_at(size_t) = 0;
+            inline void place(uint16_t usage, uint16_t position, std::string key) {
+                std::move_backward(words + position, words + usage, words + usage + 1);
+                words[position] = string_word(key);
+                Base::place(usage, position, std::move(key));
+            }
 
-            virtual V &value_at(size_t) = 0;
+            inline std::string take(uint16_t usage, uint16_t position) {
+                std::move(words + position + 1, words + usage, words + position);
+                return Base::take(usage, position);
+            }
 
-            virtual K *node_keys() = 0;
+            inline std::string exchange(uint16_t usage, uint16_t position, std::string key) {
+                words[position] = string_word(key);
+                return Base::exchange(usage, position, std::move(key));
+            }
 
-            virtual V *node_values() = 0;
+            template<typename Next>
+            inline void fill(uint16_t n, Next next) {
+                Base::fill(n, next);
+                for (uint16_t i = 0; i < n; ++i) {
+                    words[i] = string_word(this->get(i));
+                }
+            }
 
-            virtual std::pair<K, V> erase(uint16_t index, AbstractBTNode **root) = 0;
+            inline void copy_from(word_slots &that, uint16_t usage) {
+                Base::copy_from(that, usage);
+                std::copy(that.words, that.words + usage, words);
+            }
 
-            virtual AbstractBTNode *&child_at(size_t) = 0;
+            template<typename Compare>
+            inline unsigned search(uint16_t usage, const std::string &key, Compare &comp) {
+                auto [lo, hi] = word_run(words, usage, string_word(key));
+                auto keys = this->data();
+                uint16_t position = std::lower_bound(keys + lo, keys + hi, key, comp) - keys;
+                if (position != hi && !comp(key, keys[position])) {
+                    return FOUND | position;
+                }
+                return GO_DOWN | position;
+            }
+        };
 
-            virtual void traversal_copy(AbstractBTNode *now, Compare &new_comp) = 0;
+        /*
+         * std::string keys of a leaf, in one byte arena: the prefix shared by all keys of the node comes first and
+         * is stored once, then the rest of every key in order, `ends` marking where each one stops. A node costs
+         * a single buffer for all its keys instead of a string object (and likely a heap copy) per slot, and
+         * searches and comparisons run on views into the arena; only `get` builds a key. Searches go by the
+         * words of the suffixes, as in internal nodes. A key moving in that does not share the prefix shortens
+         * it; `fill` and `repack` make it the longest common one again.
+         */
+        template<size_t N>
+        struct prefix_slots {
+            static constexpr bool encoded = true;
+
+            std::string bytes;
+            uint32_t shared = 0; // length of the prefix
+            uint32_t ends[N];
+            uint64_t words[N]; // of the suffixes
+
+            static inline size_t common(std::string_view a, std::string_view b) {
+                auto length = std::min(a.size(), b.size());
+                return std::mismatch(a.data(), a.data() + length, b.data()).first - a.data();
+            }
 
-            virtual AbstractBTNode *same_type(Compare &new_comp) = 0;
+            inline uint32_t begin(size_t i) const {
+                return i ? ends[i - 1] : shared;
+            }
 
-            virtual ~AbstractBTNode() = default;
+            inline std::string_view prefix() const {
+                return {bytes.data(), shared};
+            }
 
-#ifdef DEBUG_MODE
+            inline std::string_view suffix(size_t i) const {
+                return {bytes.data() + begin(i), ends[i] - begin(i)};
+            }
 
-            virtual void display(size_t indent) = 0;
+            // lay the arena out again with a prefix of `keep` bytes, `skip` bytes of every old suffix moving
+            // into it (or, with keep below the old prefix, its tail moving in front of every suffix)
+            inline void rebuild(uint16_t usage, uint32_t keep, uint32_t skip = 0) {
+                std::string next;
+                next.reserve(keep + skip + ends[usage - 1] - shared + usage * (shared - keep) - usage * skip);
+                next.append(bytes, 0, keep);
+                next.append(bytes, shared, skip);
+                for (uint32_t i = 0, from = shared; i < usage; ++i) {
+                    auto to = ends[i];
+                    next.append(bytes, keep, shared - keep);
+                    next.append(bytes, from + skip, to - from - skip);
+                    ends[i] = next.size();
+                    from = to;
+                }
+                bytes = std::move(next); // a fresh buffer, so that a long key gone gives its space back
+                shared = keep + skip;
+                for (uint16_t i = 0; i < usage; ++i) {
+                    words[i] = string_word(suffix(i));
+                }
+            }
 
-#endif
+            // shorten the prefix to the part `key` shares
+            inline void share(std::string_view key, uint16_t usage) {
+                auto keep = common(prefix(), key);
+                if (keep < shared) rebuild(usage, keep);
+            }
 
-            friend BTree<K, V, UseBinary, B, Compare>;
-        };
+            // the key at `i` against `key`, like std::string::compare, without building it
+            inline int order(size_t i, std::string_view key) const {
+                auto head = prefix();
+                if (auto c = head.compare(key.substr(0, head.size()))) return c;
+                return suffix(i).compare(key.substr(head.size()));
+            }
 
-        template<typename K, typename V, bool IsInternal, bool UseBinary, typename Compare, size_t B>
-        struct alignas(64) BTreeNode : AbstractBTNode<K, V, UseBinary, B, Compare> {
-            static_assert(2 * B < FOUND, "B is too large");
-            static_assert(B > 2, "B is too small");
-            using Node = AbstractBTNode<K, V, UseBinary, B, Compare>;
-            using NodePtr = Node *;
-            using SplitResult = typename Node::SplitResult;
-            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
-            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            inline std::string get(size_t i) const {
+                std::string key;
+                key.reserve(shared + ends[i] - begin(i));
+                return key.append(prefix()).append(suffix(i));
+            }
 
-            KeyBlock __keys[2 * B - 1];
-            ValueBlock __values[2 * B - 1];
+            // the keys are built in one reused buffer
+            template<typename F>
+            inline void each(uint16_t usage, F f) const {
+                std::string key(prefix());
+                for (uint16_t i = 0; i < usage; ++i) {
+                    key.resize(shared);
+                    key.append(suffix(i));
+                    f(i, std::as_const(key));
+                }
+            }
 
-            NodePtr children[IsInternal ? (2 * B) : 0];
-            NodePtr parent = nullptr;
-            uint16_t usage = 0;
-            uint16_t parent_idx = 0;
+            inline std::string release(size_t i) {
+                return get(i);
+            }
 
-            using LocFlag = uint;
+            inline void place(uint16_t usage, uint16_t position, std::string key) {
+                if (usage == 0) {
+                    bytes = std::move(key);
+                    shared = ends[0] = bytes.size();
+                    words[0] = 0;
+                    return;
+                }
+                share(key, usage);
+                auto at = begin(position);
+                uint32_t length = key.size() - shared;
+                bytes.insert(at, key, shared);
+                std::move_backward(ends + position, ends + usage, ends + usage + 1);
+                ends[position] = at;
+                for (uint16_t i = position; i <= usage; ++i) ends[i] += length;
+                std::move_backward(words + position, words + usage, words + usage + 1);
+                words[position] = string_word(suffix(position));
+            }
 
-            BTreeNode(Compare &comp) : Node(comp) {
-#ifdef DEBUG_MODE
-                alive_node++;
-#endif
-                std::memset(__keys, 0, sizeof(__keys));
-                std::memset(__values, 0, sizeof(__values));
+            inline std::string take(uint16_t usage, uint16_t position) {
+                auto key = get(position);
+                auto at = begin(position);
+                uint32_t length = ends[position] - at;
+                bytes.erase(at, length);
+                std::move(ends + position + 1, ends + usage, ends + position);
+                for (uint16_t i = position; i + 1 < usage; ++i) ends[i] -= length;
+                std::move(words + position + 1, words + usage, words + position);
+                return key;
             }
 
-            inline NodePtr &node_parent() override {
-                return parent;
+            inline std::string exchange(uint16_t usage, uint16_t position, std::string key) {
+                auto old = get(position);
+                share(key, usage);
+                auto at = begin(position);
+                auto rest = std::string_view(key).substr(shared);
+                bytes.replace(at, ends[position] - at, rest);
+                int64_t delta = int64_t(at + rest.size()) - ends[position];
+                for (uint16_t i = position; i < usage; ++i) ends[i] += delta;
+                words[position] = string_word(rest);
+                return old;
             }
 
-            inline uint16_t &node_usage() override {
-                return usage;
+            template<typename Next>
+            inline void fill(uint16_t n, Next next) {
+                bytes.clear();
+                shared = 0;
+                for (uint16_t i = 0; i < n; ++i) {
+                    bytes.append(next());
+                    ends[i] = bytes.size();
+                }
+                if (n) rebuild(n, 0, common(suffix(0), suffix(n - 1)));
             }
 
-            inline uint16_t &node_idx() override {
-                return parent_idx;
+            inline void copy_from(prefix_slots &that, uint16_t usage) {
+                bytes = that.bytes;
+                shared = that.shared;
+                std::copy(that.ends, that.ends + usage, ends);
+                std::copy(that.words, that.words + usage, words);
             }
 
-            inline LocFlag local_search(const K &key) {
-                ASSERT(usage < 2 * B);
-                if constexpr (UseBinary) {
-                    uint16_t position = std::lower_bound(keys, keys + usage, key, this->comp) - keys;
-                    if (position != usage && !Node::comp(key, keys[position])) {
-                        return FOUND | position;
-                    }
-                    return GO_DOWN | position;
-                } else {
-                    uint i = 0;
-                    for (; i < usage && this->comp(keys[i], key); ++i);
-                    if (i == usage) return GO_DOWN | usage;
-                    if (this->comp(key, keys[i])) {
-                        return GO_DOWN | i;
-                    }
-                    return FOUND | i;
-                }
+            inline void destroy(uint16_t) {
+                bytes = std::string();
+                shared = 0;
             }
 
-            bool member(const K &key) override {
-                ASSERT(usage < 2 * B);
-                auto flag = local_search(key);
-                if (flag & FOUND) {
-                    return true;
-                }
-                if constexpr (IsInternal) {
-                    return children[flag & GO_DOWN_MASK]->member(key);
-                } else return false;
+            // keys are in order, so what the first and the last suffix share, all of them share
+            inline void repack(uint16_t usage) {
+                if (usage == 0) return;
+                auto extra = common(suffix(0), suffix(usage - 1));
+                if (extra) rebuild(usage, shared, extra);
+                else if (bytes.capacity() > 2 * bytes.size() + 64) bytes.shrink_to_fit();
             }
 
-            typename Node::SplitResult split() {
-                ASSERT(usage == 2 * B - 1);
-                auto l = new BTreeNode(this->comp);
-                auto r = new BTreeNode(this->comp);
-                l->usage = r->usage = B - 1;
-                l->parent = r->parent = this->parent;
-                std::uninitialized_move(keys, keys + B - 1, l->keys);
-                std::uninitialized_move(keys + B, keys + usage, r->keys);
-                std::uninitialized_move(values, values + B - 1, l->values);
-                std::uninitialized_move(values + B, values + usage, r->values);
-                auto result = SplitResult{
-                        .l = l,
-                        .r = r,
-                        .key = std::move(keys[B - 1]),
-                        .value = std::move(values[B - 1]),
-                };
-                std::destroy(keys, keys + usage);
-                std::destroy(values, values + usage);
-                this->usage = 0;
-                if constexpr (IsInternal) {
-                    std::memcpy(l->children, children, B * sizeof(NodePtr));
-                    std::memcpy(r->children, children + B, B * sizeof(NodePtr));
-                    for (size_t i = 0; i < B; ++i) {
-                        l->children[i]->node_parent() = l;
-                        l->children[i]->node_idx() = i;
-                        r->children[i]->node_parent() = r;
-                        r->children[i]->node_idx() = i;
-                    }
+            // rule the key out against the prefix, then narrow it down by the words of the suffixes
+            template<typename Compare>
+            inline unsigned search(uint16_t usage, const std::string &key, Compare &) const {
+                auto order = prefix().compare(std::string_view(key).substr(0, shared));
+                if (order < 0) return GO_DOWN | usage;
+                if (order > 0 || key.size() < shared) return GO_DOWN | 0;
+                auto rest = std::string_view(key).substr(shared);
+                auto [lo, hi] = word_run(words, usage, string_word(rest));
+                auto end = hi;
+                while (lo < hi) {
+                    uint16_t mid = (lo + hi) / 2;
+                    if (suffix(mid) < rest) lo = mid + 1;
+                    else hi = mid;
                 }
-                return result;
+                if (lo != end && suffix(lo) == rest) {
+                    return FOUND | lo;
+                }
+                return GO_DOWN | lo;
             }
+        };
 
-            inline K *node_keys() override {
-                return reinterpret_cast<K *>(__keys);
+        /*
+         * Integral keys of a leaf: frame-of-reference encoding. A base no larger than any key of the node is
+         * kept once, and the representation of the rest is picked per node from its key range:
+         * - a dense range (fewer values than there are bits in the slots, at least one in eight of them taken)
+         *   becomes a presence bitmap over the distances from the base: a lookup is a bit test, the slot of a
+         *   key is the population count of the bits below it, and keys are listed by counting trailing zeros.
+         *   Reading the i-th key alone has to count the bits before it, so whole nodes are read with `each`;
+         * - otherwise the slots hold the distance of every key from the base, in the narrowest width below the
+         *   key width that holds the range, and searching compares the narrow deltas several per vector lane;
+         * - a node whose range fits no narrower width keeps its keys in full, searched by the search policy.
+         * A key moving in that does not fit the current representation has the node re-encoded; `fill` and
+         * `repack` rebase the node on its smallest key.
+         */
+        template<typename K, size_t N>
+        struct frame_slots {
+            static constexpr bool encoded = true;
+            using U = std::make_unsigned_t<K>;
+
+            static constexpr size_t WORDS = N * sizeof(K) / 8;
+            static constexpr uint64_t BITS = WORDS * 64;
+
+            enum Mode : uint8_t {
+                FULL = 0, DELTA8 = 1, DELTA16 = 2, DELTA32 = 4, // the width of a delta in bytes
+                BITMAP = 8
             };
 
-            inline V *node_values() override {
-                return reinterpret_cast<V *>(__values);
+            Mode mode = FULL;
+            K base = 0;
+            union {
+                K full[N];
+                uint8_t u8[N];
+                uint16_t u16[N];
+                uint32_t u32[N];
+                uint64_t words[WORDS];
             };
 
-            inline NodePtr same_type(Compare &new_comp) override {
-                return new BTreeNode(new_comp);
-            };
+            frame_slots() {}
 
-            inline void traversal_moveup(NodePtr now, Compare &new_comp) {
-                std::uninitialized_copy(keys, keys + usage, now->keys);
-                std::uninitialized_copy(values, values + usage, now->values);
-                now->node_usage() = usage;
-                now->node_idx() = parent_idx;
-                if (parent == nullptr) { return; }
-                auto new_parent = now->node_parent();
-                if (new_parent == nullptr) {
-                    ASSERT(parent_idx == 0);
-                    new_parent = new BTreeNode<K, V, true, UseBinary, Compare, B>(new_comp);
-                    new_parent->child_at(0) = now;
-                    now->node_parent() = new_parent;
+            // the representation of `usage` keys `span` apart; a bitmap only where they fill an eighth of it,
+            // which keeps the words a select or a walk skips over few
+            static inline Mode narrowest(U span, uint16_t usage) {
+                if (span < BITS && uint64_t(span) < uint64_t(usage) * 8) return BITMAP;
+                if (span <= 0xFFu) return DELTA8;
+                if constexpr (sizeof(K) > 2) {
+                    if (uint64_t(span) <= 0xFFFFu) return DELTA16;
                 }
-                new_parent->child_at(new_parent->node_usage()) = now;
-                new_parent->node_usage() += 1;
-                return parent->traversal_copy(new_parent, new_comp);
+                if constexpr (sizeof(K) > 4) {
+                    if (uint64_t(span) <= 0xFFFFFFFFu) return DELTA32;
+                }
+                return FULL;
             }
 
-            void traversal_copy(NodePtr now, Compare &new_comp) override {
-                ASSERT(dynamic_cast<BTreeNode *>(now)); // must of the same type
-                if constexpr (IsInternal) {
-                    if (usage + 1 == now->node_usage()) {
-                        return traversal_moveup(now, new_comp);
+            inline bool fits(K key) const {
+                if (mode == FULL) return true;
+                if (key < base) return false;
+                uint64_t delta = U(U(key) - U(base));
+                return delta < (mode == BITMAP ? BITS : uint64_t(1) << (8 * mode));
+            }
+
+            // the key behind the i-th set bit: skip whole words by population count, then clear the lower bits
+            inline K select(size_t i) const {
+                for (size_t w = 0; w < WORDS; ++w) {
+                    auto count = size_t(std::popcount(words[w]));
+                    if (i < count) {
+                        auto word = words[w];
+                        for (; i; --i) word &= word - 1;
+                        return K(U(base) + U(w * 64 + std::countr_zero(word)));
                     }
-                    auto child = children[now->node_usage()]->same_type(new_comp);
-                    child->node_parent() = now;
-                    return children[now->node_usage()]->traversal_copy(child, new_comp);
-                } else {
-                    return traversal_moveup(now, new_comp);
+                    i -= count;
                 }
-            };
+                return base; // only for a reader racing with the writer, which retries
+            }
 
-            static NodePtr singleton(NodePtr l, NodePtr r, K key, V value, Compare &_comp) {
-                auto node = new BTreeNode<K, V, true, UseBinary, Compare, B>(_comp);
-                node->usage = 1;
-                new(node->__values) V(std::move(value));  // no need for destroy, directly move
-                new(node->__keys) K(std::move(key));
-                node->children[0] = l;
-                l->node_idx() = 0;
-                l->node_parent() = node;
-                node->children[1] = r;
-                r->node_idx() = 1;
-                r->node_parent() = node;
-                return node;
+            inline void flip(K key) {
+                uint64_t delta = U(U(key) - U(base));
+                words[delta / 64] ^= uint64_t(1) << (delta % 64);
             }
 
-            std::optional<V> insert(const K &key, const V &value, NodePtr *root) override {
-                auto res = local_search(key);
-                if (res & FOUND) {
-                    V original = std::move(values[res & FOUND_MASK]);
-                    std::destroy_at(values + (res & FOUND_MASK));
-                    new(values + (res & FOUND_MASK)) V(value);
-                    return {original};
+            inline bool present(K key) const {
+                uint64_t delta = U(U(key) - U(base));
+                return (words[delta / 64] >> (delta % 64)) & 1u;
+            }
+
+            template<typename F>
+            inline auto on_slots(F f) {
+                switch (mode) {
+                    case DELTA8:
+                        return f(u8);
+                    case DELTA16:
+                        return f(u16);
+                    case DELTA32:
+                        return f(u32);
+                    default:
+                        return f(full);
                 }
-                auto position = res & GO_DOWN_MASK;
-                if constexpr (IsInternal) {
-                    return children[position]->insert(key, value, root);
-                } else {
-                    uninitialized_move_back(values + position, values + usage);
-                    uninitialized_move_back(keys + position, keys + usage);
-                    new(values + position) V(value);
-                    new(keys + position) K(key);
-                    usage++;
-                    if (usage == 2 * B - 1) /* leaf if full */ {
-                        auto result = split();
-                        if (parent)
-                            parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value),
-                                          parent_idx, root);
-                        else {
-                            auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
-                                                  this->comp);
-                            delete *root;
-                            *root = node;
-                        }
-                    }
-                    return std::nullopt;
+            }
+
+            inline K get(size_t i) const {
+                switch (mode) {
+                    case BITMAP:
+                        return select(i);
+                    case DELTA8:
+                        return K(U(base) + u8[i]);
+                    case DELTA16:
+                        return K(U(base) + u16[i]);
+                    case DELTA32:
+                        return K(U(base) + u32[i]);
+                    default:
+                        return full[i];
                 }
             }
 
-            void adopt(NodePtr l, NodePtr r, K key, V value, size_t position, NodePtr *root) override {
-                uninitialized_move_back(values + position, values + usage);
-                uninitialized_move_back(keys + position, keys + usage);
-                if constexpr (IsInternal) {
-                    std::memmove(children + position + 1, children + position,
-                                 (usage + 1 - position) * sizeof(NodePtr));
-                    delete (children[position]);
-                    children[position] = l;
-                    l->node_parent() = this;
-                    children[position + 1] = r;
-                    r->node_parent() = this;
-                    for (int i = position; i < usage + 2; ++i) {
-                        children[i]->node_idx() = i;
+            // the keys held plain, valid only while the node is not encoded
+            inline K *data() {
+                return full;
+            }
+
+            // store `key`, which fits the current width
+            inline void set(uint16_t i, K key) {
+                on_slots([&](auto *slots) {
+                    using T = std::remove_pointer_t<decltype(slots)>;
+                    if constexpr (std::is_same_v<T, K>) slots[i] = key;
+                    else slots[i] = T(U(key) - U(base));
+                });
+            }
+
+            inline void encode(const K *keys, uint16_t usage) {
+                base = usage ? keys[0] : K();
+                mode = usage ? narrowest(U(keys[usage - 1]) - U(keys[0]), usage) : BITMAP;
+                if (mode == BITMAP) {
+                    std::fill(words, words + WORDS, 0);
+                    uint16_t i = 0;
+                    // a bitmap holds no repeated keys, whatever a caller feeds it
+                    for (; i < usage && (i == 0 || keys[i - 1] < keys[i]); ++i) {
+                        flip(keys[i]);
                     }
+                    if (i == usage) return;
+                    mode = FULL;
                 }
-                new(values + position) V(std::move(value));
-                new(keys + position) K(std::move(key));
-                usage++;
-                if (usage == 2 * B - 1) {
-                    auto result = split();
-                    if (parent) {
-                        parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value), parent_idx,
-                                      root);
-                    } else {
-                        auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
-                                              this->comp);
-                        delete *root;
-                        *root = node;
+                for (uint16_t i = 0; i < usage; ++i) {
+                    set(i, keys[i]);
+                }
+            }
+
+            // a bitmap is walked set bit by set bit rather than selected key by key
+            template<typename F>
+            inline void each(uint16_t usage, F f) const {
+                if (mode != BITMAP) {
+                    for (uint16_t i = 0; i < usage; ++i) f(i, get(i));
+                    return;
+                }
+                uint16_t i = 0;
+                for (size_t w = 0; w < WORDS && i < usage; ++w) {
+                    for (auto word = words[w]; word && i < usage; word &= word - 1) {
+                        f(i++, K(U(base) + U(w * 64 + std::countr_zero(word))));
                     }
                 }
             }
 
+            inline void decode(K *keys, uint16_t usage) const {
+                each(usage, [&](uint16_t i, K key) { keys[i] = key; });
+            }
 
-            void borrow_left(NodePtr from) {
-                ASSERT(dynamic_cast<BTreeNode *>(from));
-                ASSERT(parent); // root will never borrow
-                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
-                ASSERT(parent_idx > 0);
-                ASSERT(parent_idx == from->node_idx() + 1);
-                ASSERT(from->node_usage() - 1 >= B - 1);
-                ASSERT(usage + 1 >= B - 1);
+            inline K release(size_t i) {
+                return get(i);
+            }
 
-                uninitialized_move_back(keys, keys + usage);
-                uninitialized_move_back(values, values + usage);
+            inline void place(uint16_t usage, uint16_t position, K key) {
+                if (usage > 0 && mode == BITMAP && fits(key) && !present(key)) {
+                    flip(key);
+                    return;
+                }
+                if (usage > 0 && mode != BITMAP && fits(key)) {
+                    on_slots([&](auto *slots) {
+                        std::memmove(slots + position + 1, slots + position, (usage - position) * sizeof(*slots));
+                    });
+                    set(position, key);
+                    return;
+                }
+                K keys[N];
+                decode(keys, usage);
+                std::memmove(keys + position + 1, keys + position, (usage - position) * sizeof(K));
+                keys[position] = key;
+                encode(keys, usage + 1);
+            }
 
-                /* get node from parent */
-                new(values) V(std::move(parent->value_at(parent_idx - 1)));
-                new(keys) K(std::move(parent->key_at(parent_idx - 1)));
-                std::destroy_at(parent->values + parent_idx - 1);
-                std::destroy_at(parent->keys + parent_idx - 1);
-                usage++;
+            // the base stays below the keys that are left, so nothing else changes
+            inline K take(uint16_t usage, uint16_t position) {
+                K key = get(position);
+                if (mode == BITMAP) {
+                    flip(key);
+                    return key;
+                }
+                on_slots([&](auto *slots) {
+                    std::memmove(slots + position, slots + position + 1, (usage - position - 1) * sizeof(*slots));
+                });
+                return key;
+            }
 
-                /* update_parent */
-                auto from_usage = from->node_usage();
-                new(parent->values + parent_idx - 1) V(std::move(from->value_at(from_usage - 1)));
-                new(parent->keys + parent_idx - 1) K(std::move(from->key_at(from_usage - 1)));
-                /* update from */
-                std::destroy_at(from->values + (from_usage - 1));
-                std::destroy_at(from->keys + (from_usage - 1));
-                from->node_usage() -= 1;
+            inline K exchange(uint16_t usage, uint16_t position, K key) {
+                K old = get(position);
+                if (mode == BITMAP && fits(key) && !present(key)) {
+                    flip(old);
+                    flip(key);
+                } else if (mode != BITMAP && fits(key)) {
+                    set(position, key);
+                } else {
+                    K keys[N];
+                    decode(keys, usage);
+                    keys[position] = key;
+                    encode(keys, usage);
+                }
+                return old;
+            }
 
-                /* take the child */
-                if constexpr (IsInternal) {
-                    std::memmove(children + 1, children, usage * sizeof(NodePtr));
-                    children[0] = from->child_at(from_usage);
-                    from->child_at(from_usage) = nullptr;
-                    children[0]->node_idx() = 0;
-                    children[0]->node_parent() = this;
-                    for (auto i = 1; i <= usage; ++i) {
-                        children[i]->node_idx() = i;
-                    }
+            template<typename Next>
+            inline void fill(uint16_t n, Next next) {
+                K keys[N];
+                for (uint16_t i = 0; i < n; ++i) {
+                    keys[i] = next();
                 }
+                encode(keys, n);
             }
 
-            void borrow_right(NodePtr from) {
-                ASSERT(dynamic_cast<BTreeNode *>(from));
-                ASSERT(parent); // root will never borrow
-                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
-                ASSERT(parent_idx == 0); // only the first element call this
-                ASSERT(parent_idx < parent->node_usage());
-                ASSERT(parent_idx == from->node_idx() - 1);
-                ASSERT(from->node_usage() - 1 >= B - 1);
-                ASSERT(usage + 1 >= B - 1);
+            inline void copy_from(frame_slots &that, uint16_t) {
+                *this = that;
+            }
 
-                auto from_node = static_cast<BTreeNode *>(from);
-                /* update this node */
-                new(values + usage) V(std::move(parent->value_at(parent_idx)));
-                new(keys + usage) K(
-                        std::move(parent->key_at(parent_idx))); // last element is uninitialized, direct move construct
-                std::destroy_at(parent->values + parent_idx);
-                std::destroy_at(parent->keys + parent_idx);
-                if constexpr (IsInternal) {
-                    children[usage + 1] = from_node->children[0];
-                    children[usage + 1]->node_parent() = this;
-                    children[usage + 1]->node_idx() = usage + 1;
-                }
-                usage++;
+            inline void destroy(uint16_t) {}
 
-                /* update parent */
-                new(parent->values + parent_idx) V(std::move(from_node->values[0]));
-                new(parent->keys + parent_idx) K(std::move(from_node->keys[0]));
-                std::destroy_at(from_node->values);
-                std::destroy_at(from_node->keys);
+            inline void repack(uint16_t usage) {
+                K keys[N];
+                decode(keys, usage);
+                encode(keys, usage);
+            }
 
-                /* update from node */
-                uninitialized_move_forward(from_node->keys + 1, from_node->keys + from_node->usage);
-                uninitialized_move_forward(from_node->values + 1, from_node->values + from_node->usage);
+            template<typename T>
+            static inline unsigned locate(const T *deltas, uint16_t usage, U delta) {
+                auto probe = T(delta);
+                unsigned position = 0;
+                for (unsigned i = 0; i < usage; ++i) {
+                    position += deltas[i] < probe;
+                }
+                if (position != usage && deltas[position] == probe) {
+                    return FOUND | position;
+                }
+                return GO_DOWN | position;
+            }
 
-                // memcpy should be good? but standards said UB if overlapped
-                if constexpr (IsInternal) {
-                    std::memmove(from_node->children, from_node->children + 1, from_node->usage * sizeof(NodePtr));
-                    from_node->children[from_node->usage] = nullptr;
-                    for (auto i = 0; i < from_node->usage; ++i) {
-                        from_node->children[i]->node_idx() = i;
-                    }
+            inline unsigned test(U delta) const {
+                auto word = delta / 64, bit = delta % 64;
+                unsigned position = 0;
+                for (U i = 0; i < word; ++i) {
+                    position += std::popcount(words[i]);
                 }
-                from_node->usage -= 1;
+                position += std::popcount(words[word] & ((uint64_t(1) << bit) - 1));
+                if ((words[word] >> bit) & 1u) {
+                    return FOUND | position;
+                }
+                return GO_DOWN | position;
             }
 
-            static void merge(NodePtr a, NodePtr b, NodePtr *root) {
-                auto left = static_cast<BTreeNode *>(a);
-                auto right = static_cast<BTreeNode *>(b);
-                auto parent = static_cast<BTreeNode<K, V, true, UseBinary, Compare> *>(left->parent);
-                ASSERT(dynamic_cast<BTreeNode *>(a));
-                ASSERT(dynamic_cast<BTreeNode *>(b));
-                ASSERT((dynamic_cast <BTreeNode<K, V, true, UseBinary, Compare> *> (left->parent))); // root will never borrow
-                ASSERT(left->parent == right->parent);
-                ASSERT(left->parent_idx == right->node_idx() - 1);
-                ASSERT(left->usage + right->usage + 1 < 2 * B - 1);
+            // 0 while the keys are held in full, for the search policy to take over
+            template<typename Compare>
+            inline unsigned search(uint16_t usage, const K &key, Compare &) {
+                auto current = mode; // read once, as optimistic readers race with the writer
+                if (current == FULL) return 0;
+                if (key < base) return GO_DOWN | 0;
+                uint64_t delta = U(U(key) - U(base));
+                switch (current) {
+                    case BITMAP:
+                        return delta < BITS ? test(U(delta)) : GO_DOWN | usage;
+                    case DELTA8:
+                        return delta <= 0xFFu ? locate(u8, usage, U(delta)) : GO_DOWN | usage;
+                    case DELTA16:
+                        return delta <= 0xFFFFu ? locate(u16, usage, U(delta)) : GO_DOWN | usage;
+                    default:
+                        return delta <= 0xFFFFFFFFu ? locate(u32, usage, U(delta)) : GO_DOWN | usage;
+                }
+            }
+        };
 
-                new(left->values + left->usage) V(std::move(parent->values[left->parent_idx]));
-                new(left->keys + left->usage) K(std::move(parent->keys[left->parent_idx]));
-                std::destroy_at(parent->values + left->parent_idx);
-                std::destroy_at(parent->keys + left->parent_idx);
-                uninitialized_move_forward(parent->values + right->parent_idx, parent->values + parent->usage);
-                uninitialized_move_forward(parent->keys + right->parent_idx, parent->keys + parent->usage);
-                std::memmove(parent->children + right->parent_idx, parent->children + right->parent_idx + 1,
-                             (parent->usage - right->parent_idx) * sizeof(NodePtr));
-                parent->children[parent->usage--] = nullptr;
+        /*
+         * The key storage of leaves: encoded where the key type has an encoding, plain otherwise. Integral keys
+         * stay plain under InterpolationSearch, which asked for probing the keys themselves: a frame-encoded
+         * node would answer every search from its deltas or bitmap and the policy would never run.
+         */
+        template<typename K, typename Compare, unsigned Search, size_t N>
+        struct leaf_slots {
+            using type = plain_slots<K, N>;
+        };
 
+        template<typename K, unsigned Search, size_t N>
+        requires (std::is_integral_v<K> && !std::is_same_v<K, bool> && sizeof(K) >= 2 && Search != InterpolationSearch)
+        struct leaf_slots<K, std::less<K>, Search, N> {
+            using type = frame_slots<K, N>;
+        };
 
-                left->usage++;
-                std::uninitialized_move(right->values, right->values + right->usage, left->values + left->usage);
-                std::uninitialized_move(right->keys, right->keys + right->usage, left->keys + left->usage);
-                std::destroy(right->values, right->values + right->usage);
-                std::destroy(right->keys, right->keys + right->usage);
+        template<typename K, unsigned Search, size_t N>
+        requires (std::is_integral_v<K> && !std::is_same_v<K, bool> && sizeof(K) >= 2 && Search != InterpolationSearch)
+        struct leaf_slots<K, std::less<>, Search, N> {
+            using type = frame_slots<K, N>;
+        };
 
-                if constexpr (IsInternal) {
-                    std::memcpy(left->children + left->usage, right->children, (right->usage + 1) * sizeof(NodePtr));
-                    for (auto i = left->usage; i <= left->usage + right->usage; ++i) {
-                        left->children[i]->node_idx() = i;
-                        left->children[i]->node_parent() = left;
-                    }
+        template<unsigned Search, size_t N>
+        struct leaf_slots<std::string, std::less<std::string>, Search, N> {
+            using type = prefix_slots<N>;
+        };
+
+        template<unsigned Search, size_t N>
+        struct leaf_slots<std::string, std::less<>, Search, N> {
+            using type = prefix_slots<N>;
+        };
+
+        // the key storage of internal nodes, which hold their keys plain
+        template<typename K, typename Compare, size_t N>
+        struct inner_slots {
+            using type = plain_slots<K, N>;
+        };
+
+        template<size_t N>
+        struct inner_slots<std::string, std::less<std::string>, N> {
+            using type = word_slots<N>;
+        };
+
+        template<size_t N>
+        struct inner_slots<std::string, std::less<>, N> {
+            using type = word_slots<N>;
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct AbstractBTNode {
+
+            using Context = TreeContext<K, V, Search, B, Compare>;
+            using LeafSlots = typename leaf_slots<K, Compare, Search, 2 * B - 1>::type;
+            // how keys are read out of nodes: rebuilt by value where leaves store them encoded
+            using KeyRef = std::conditional_t<LeafSlots::encoded, K, const K &>;
+
+            Context &ctx;
+
+            struct SplitResult {
+                AbstractBTNode *l, *r;
+                K key;
+                V value;
+            };
+
+            struct iterator {
+                uint16_t idx;
+                AbstractBTNode *node;
+
+                inline bool operator!=(const iterator &that) noexcept {
+                    return idx != that.idx || node != that.node;
+                }
+
+#ifndef __cpp_lib_three_way_comparison
+                inline bool operator==(const iterator &that) noexcept {
+                    return idx == that.idx && node == that.node;
+                }
+#endif
+
+                iterator operator++(int) {
+                    return node->successor(idx);
+                }
+
+                iterator &operator++() {
+                    auto res = node->successor(idx);
+                    this->node = res.node;
+                    this->idx = res.idx;
+                    return *this;
+                }
+
+                std::pair<KeyRef, V &> operator*() {
+                    return {node->key_at(idx), node->value_at(idx)};
+                }
+            };
+
+            size_t version; // of the tree when this node was created
+            // odd while the writer changes the node in place, and for good once the node is unlinked
+            std::atomic<uint32_t> seq = 0;
+
+            // changed since the last checkpoint, and some node below changed; new nodes count as changed
+            bool dirty = true, dirty_below = false;
+
+            AbstractBTNode(Context &ctx) : ctx(ctx), version(ctx.version) {}
+
+            // flag the way up to the root, so that a checkpoint finds the changed nodes without visiting the rest
+            inline void mark_ancestors() {
+                for (auto node = node_parent(); node && !node->dirty_below; node = node->node_parent()) {
+                    node->dirty_below = true;
                 }
+            }
+
+            // bracket an in-place change for optimistic readers; a node leaving the tree is never closed again.
+            // Every in-place change goes through here, so this is also where the node becomes dirty.
+            inline void write_begin() {
+                dirty = true;
+                mark_ancestors();
+                seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            inline void write_end() {
+                seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            virtual bool member(const K &key) = 0;
+
+            virtual iterator find(const K &key) = 0;
+
+            // first entry of this subtree not below `key`, or end() if there is none
+            virtual iterator lower_bound(const K &key) = 0;
+
+            // the node of this subtree holding `key`, or the leaf it would be inserted into
+            virtual AbstractBTNode *locate(const K &key) = 0;
+
+            // one level of a search: the child to go on with (already prefetched), or nullptr once `found` is set
+            virtual AbstractBTNode *descend(const K &key, iterator &found) = 0;
+
+            // one level of an optimistic search, on a node the writer may be changing: `idx` stays within the
+            // node's usage whatever it reads; the child to go on with, or nullptr
+            virtual AbstractBTNode *probe(const K &key, uint16_t &idx, bool &found) = 0;
+
+            virtual std::optional<V> insert(const K &key, const V &value, AbstractBTNode **root) = 0;
+
+            virtual void
+            adopt(AbstractBTNode *l, AbstractBTNode *r, K key, V value, size_t position, AbstractBTNode **root) = 0;
+
+            virtual void
+            graft(AbstractBTNode *l, AbstractBTNode *r, K key, V value, size_t position, AbstractBTNode **root) = 0;
+
+            virtual void fix_underflow(AbstractBTNode **root) = 0;
+
+            virtual AbstractBTNode *&node_parent() = 0;
+
+            virtual uint16_t &node_idx() = 0;
+
+            virtual uint16_t &node_usage() = 0;
+
+            virtual uint8_t &node_height() = 0;
+
+            virtual iterator successor(uint16_t idx) = 0;
+
+            virtual iterator predecessor(uint16_t idx) = 0;
+
+            virtual iterator min() = 0;
+
+            virtual iterator max() = 0;
+
+            virtual KeyRef key_at(size_t) = 0;
+
+            // the key at i is below / above `key`, compared where it is stored rather than read out
+            virtual bool precedes(size_t, const K &key) = 0;
+
+            virtual bool follows(size_t, const K &key) = 0;
+
+            // a key of an internal node, which are always stored plain
+            virtual const K &separator_at(size_t) = 0;
+
+            virtual V &value_at(size_t) = 0;
+
+            virtual V *node_values() = 0;
+
+            // destroy the keys and values of this node, leaving it empty
+            virtual void drop_entries() = 0;
+
+            // refresh the per-node search metadata after the key array of this node has changed
+            virtual void touch() = 0;
+
+            virtual std::pair<K, V> erase(uint16_t index, AbstractBTNode **root) = 0;
+
+            virtual AbstractBTNode *&child_at(size_t) = 0;
+
+            virtual void traversal_copy(AbstractBTNode *now, Context &new_ctx) = 0;
+
+            virtual AbstractBTNode *same_type(Context &new_ctx) = 0;
+
+            // a private copy of this node taking its place under the parent (not at the root); children are shared
+            virtual AbstractBTNode *clone() = 0;
+
+            virtual ~AbstractBTNode() = default;
+
+            // the separators bounding the key range of this node, nullptr where it is unbounded
+            std::pair<const K *, const K *> bounds() {
+                const K *lo = nullptr, *hi = nullptr;
+                for (auto node = this; node->node_parent() && (!lo || !hi); node = node->node_parent()) {
+                    auto parent = node->node_parent();
+                    auto idx = node->node_idx();
+                    if (!lo && idx > 0) lo = &parent->separator_at(idx - 1);
+                    if (!hi && idx < parent->node_usage()) hi = &parent->separator_at(idx);
+                }
+                return {lo, hi};
+            }
+
+            // the lowest ancestor (or this node) whose key range holds `key`, for a key not below those of this node
+            AbstractBTNode *enclosing(const K &key) {
+                auto node = this;
+                while (auto parent = node->node_parent()) {
+                    auto idx = node->node_idx();
+                    if (idx < parent->node_usage() && !ctx.comp(parent->separator_at(idx), key)) {
+                        return ctx.comp(key, parent->separator_at(idx)) ? node : parent;
+                    }
+                    node = parent;
+                }
+                return node;
+            }
+
+            /*
+             * Lower bound of `key` in the whole tree, for a key not below the keys of this node: climb only until
+             * the separator above the current subtree is not below the key, then descend from there. Costs
+             * O(log d) node visits for a target d entries away.
+             */
+            iterator seek(const K &key) {
+                auto node = this;
+                while (auto parent = node->node_parent()) {
+                    auto idx = node->node_idx();
+                    if (idx < parent->node_usage() && !ctx.comp(parent->separator_at(idx), key)) {
+                        auto found = node->lower_bound(key);
+                        return found.node ? found : iterator{.idx = uint16_t(idx), .node = parent};
+                    }
+                    node = parent;
+                }
+                return node->lower_bound(key);
+            }
+
+#ifdef DEBUG_MODE
+
+            virtual void display(size_t indent) = 0;
+
+#endif
+
+            friend BTree<K, V, Search, B, Compare>;
+        };
+
+        template<typename K, typename V, bool IsInternal, unsigned Search, typename Compare, size_t B>
+        struct alignas(64) BTreeNode : AbstractBTNode<K, V, Search, B, Compare> {
+            static_assert(2 * B < FOUND, "B is too large");
+            static_assert(B > 2, "B is too small");
+            using Node = AbstractBTNode<K, V, Search, B, Compare>;
+            using NodePtr = Node *;
+            using SplitResult = typename Node::SplitResult;
+            using Context = typename Node::Context;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            using Slots = std::conditional_t<IsInternal, typename inner_slots<K, Compare, 2 * B - 1>::type,
+                    typename Node::LeafSlots>;
+            using Inner = BTreeNode<K, V, true, Search, Compare, B>;
+            using Leaf = BTreeNode<K, V, false, Search, Compare, B>;
+
+            Slots slots;
+            ValueBlock __values[2 * B - 1];
+
+            NodePtr children[IsInternal ? (2 * B) : 0];
+            NodePtr parent = nullptr;
+            uint16_t usage = 0;
+            uint16_t parent_idx = 0;
+            uint8_t height = 0; // levels above the leaves, fixed for the lifetime of the node
+
+            using LocFlag = uint;
+
+            BTreeNode(Context &ctx) : Node(ctx) {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+                std::memset(__values, 0, sizeof(__values));
+            }
+
+            inline NodePtr &node_parent() override {
+                return parent;
+            }
+
+            inline uint16_t &node_usage() override {
+                return usage;
+            }
+
+            inline uint16_t &node_idx() override {
+                return parent_idx;
+            }
+
+            inline uint8_t &node_height() override {
+                return height;
+            }
+
+            inline void touch() override {
+                slots.repack(usage);
+                if (this->ctx.index) {
+                    slots.each(usage, [&](uint16_t, const K &key) { this->ctx.index->assign(key, this); });
+                }
+            }
+
+            // the keys changed in place and only the key at `fresh` (if fresh < usage) is new to this node
+            inline void touch(uint16_t fresh) {
+                if (this->ctx.index && fresh < usage) {
+                    this->ctx.index->assign(slots.get(fresh), this);
+                }
+            }
+
+            // record a structural change of the siblings first...last (at the height of this node)
+            inline void restructured(NodePtr first, NodePtr last) {
+                this->ctx.epoch++;
+                if (height >= this->ctx.watch_height) {
+                    this->ctx.widen(first->bounds().first, last->bounds().second);
+                }
+            }
+
+            inline LocFlag local_search(const K &key) {
+                ASSERT(usage < 2 * B);
+                if constexpr (requires { slots.search(usage, key, this->ctx.comp); }) {
+                    auto flag = slots.search(usage, key, this->ctx.comp);
+                    if constexpr (requires { slots.data(); }) {
+                        // frame slots holding their keys plain for now
+                        if (!flag) return plain_search(slots.data(), key);
+                    }
+                    return flag;
+                } else {
+                    return plain_search(slots.data(), key);
+                }
+            }
+
+            // the search policy over keys stored plain
+            inline LocFlag plain_search(const K *keys, const K &key) {
+                if constexpr (Search != LinearSearch) {
+                    uint16_t position;
+                    if constexpr (Search == InterpolationSearch && interpolable<K, Compare>) {
+                        position = interpolation_search(keys, usage, key);
+                    } else {
+                        position = std::lower_bound(keys, keys + usage, key, this->ctx.comp) - keys;
+                    }
+                    if (position != usage && !this->ctx.comp(key, keys[position])) {
+                        return FOUND | position;
+                    }
+                    return GO_DOWN | position;
+                } else {
+                    uint i = 0;
+                    for (; i < usage && this->ctx.comp(keys[i], key); ++i);
+                    if (i == usage) return GO_DOWN | usage;
+                    if (this->ctx.comp(key, keys[i])) {
+                        return GO_DOWN | i;
+                    }
+                    return FOUND | i;
+                }
+            }
+
+            bool member(const K &key) override {
+                ASSERT(usage < 2 * B);
+                auto flag = local_search(key);
+                if (flag & FOUND) {
+                    return true;
+                }
+                if constexpr (IsInternal) {
+                    return children[flag & GO_DOWN_MASK]->member(key);
+                } else return false;
+            }
+
+            typename Node::iterator find(const K &key) override {
+                auto flag = local_search(key);
+                if (flag & FOUND) {
+                    return typename Node::iterator{
+                            .idx = uint16_t(flag & FOUND_MASK),
+                            .node = this
+                    };
+                }
+                if constexpr (IsInternal) {
+                    return children[flag & GO_DOWN_MASK]->find(key);
+                } else {
+                    return typename Node::iterator{
+                            .idx = 0,
+                            .node = nullptr
+                    };
+                }
+            }
+
+            typename Node::iterator lower_bound(const K &key) override {
+                auto flag = local_search(key);
+                if (flag & FOUND) {
+                    return typename Node::iterator{
+                            .idx = uint16_t(flag & FOUND_MASK),
+                            .node = this
+                    };
+                }
+                auto position = uint16_t(flag & GO_DOWN_MASK);
+                if constexpr (IsInternal) {
+                    auto found = children[position]->lower_bound(key);
+                    if (found.node) return found;
+                }
+                return typename Node::iterator{
+                        .idx = position < usage ? position : uint16_t(0),
+                        .node = position < usage ? this : nullptr
+                };
+            }
+
+            NodePtr descend(const K &key, typename Node::iterator &found) override {
+                auto flag = local_search(key);
+                if (flag & FOUND) {
+                    found = typename Node::iterator{
+                            .idx = uint16_t(flag & FOUND_MASK),
+                            .node = this
+                    };
+                    return nullptr;
+                }
+                if constexpr (IsInternal) {
+                    auto child = children[flag & GO_DOWN_MASK];
+                    __builtin_prefetch(child);
+                    __builtin_prefetch(reinterpret_cast<char *>(child) + 64);
+                    return child;
+                }
+                found = typename Node::iterator{
+                        .idx = 0,
+                        .node = nullptr
+                };
+                return nullptr;
+            }
+
+            NodePtr probe(const K &key, uint16_t &idx, bool &found) override {
+                uint16_t count = std::min<uint16_t>(usage, 2 * B - 1);
+                unsigned flag = 0;
+                if constexpr (requires { slots.search(count, key, this->ctx.comp); }) {
+                    flag = slots.search(count, key, this->ctx.comp);
+                }
+                if (flag) {
+                    found = flag & FOUND;
+                    idx = found ? flag & FOUND_MASK : flag & GO_DOWN_MASK;
+                } else if constexpr (requires { slots.data(); }) {
+                    auto keys = slots.data();
+                    idx = std::lower_bound(keys, keys + count, key, this->ctx.comp) - keys;
+                    found = idx < count && !this->ctx.comp(key, keys[idx]);
+                }
+                // slots caught mid-rewrite (a bitmap mode over keys still stored in full) can point anywhere
+                if (found ? idx >= count : idx > count) {
+                    found = false;
+                    idx = count;
+                }
+                if constexpr (IsInternal) {
+                    if (!found) return children[idx];
+                }
+                return nullptr;
+            }
+
+            NodePtr locate(const K &key) override {
+                if constexpr (IsInternal) {
+                    auto flag = local_search(key);
+                    if (!(flag & FOUND)) return children[flag & GO_DOWN_MASK]->locate(key);
+                }
+                return this;
+            }
+
+            // runs inside a write section of this node that is never closed, as the node is emptied for good
+            typename Node::SplitResult split() {
+                ASSERT(usage == 2 * B - 1);
+                auto l = new BTreeNode(this->ctx);
+                auto r = new BTreeNode(this->ctx);
+                l->usage = r->usage = B - 1;
+                l->parent = r->parent = this->parent;
+                l->height = r->height = height;
+                restructured(this, this);
+                l->slots.fill(B - 1, [this, i = uint16_t(0)]() mutable { return slots.release(i++); });
+                r->slots.fill(B - 1, [this, i = uint16_t(B)]() mutable { return slots.release(i++); });
+                std::uninitialized_move(values, values + B - 1, l->values);
+                std::uninitialized_move(values + B, values + usage, r->values);
+                auto result = SplitResult{
+                        .l = l,
+                        .r = r,
+                        .key = slots.release(B - 1),
+                        .value = std::move(values[B - 1]),
+                };
+                slots.destroy(usage);
+                std::destroy(values, values + usage);
+                this->usage = 0;
+                l->touch();
+                r->touch();
+                if constexpr (IsInternal) {
+                    std::memcpy(l->children, children, B * sizeof(NodePtr));
+                    std::memcpy(r->children, children + B, B * sizeof(NodePtr));
+                    for (size_t i = 0; i < B; ++i) {
+                        l->children[i]->node_parent() = l;
+                        l->children[i]->node_idx() = i;
+                        r->children[i]->node_parent() = r;
+                        r->children[i]->node_idx() = i;
+                    }
+                }
+                return result;
+            }
+
+            inline V *node_values() override {
+                return reinterpret_cast<V *>(__values);
+            };
+
+            inline NodePtr same_type(Context &new_ctx) override {
+                return new BTreeNode(new_ctx);
+            };
+
+            NodePtr clone() override {
+                auto copy = new BTreeNode(this->ctx);
+                copy->slots.copy_from(slots, usage);
+                std::uninitialized_copy(values, values + usage, copy->values);
+                copy->usage = usage;
+                copy->parent = parent;
+                copy->parent_idx = parent_idx;
+                copy->height = height;
+                if constexpr (IsInternal) {
+                    std::memcpy(copy->children, children, (usage + 1) * sizeof(NodePtr));
+                    for (uint16_t i = 0; i <= usage; ++i) {
+                        children[i]->node_parent() = copy;
+                    }
+                }
+                copy->touch(); // repack before the copy is reachable: readers must not see it half rebuilt
+                if (parent) {
+                    parent->write_begin();
+                    parent->child_at(parent_idx) = copy;
+                    parent->write_end();
+                }
+                copy->restructured(copy, copy);
+                return copy;
+            }
+
+            inline void traversal_moveup(NodePtr now, Context &new_ctx) {
+                static_cast<BTreeNode *>(now)->slots.copy_from(slots, usage);
+                std::uninitialized_copy(values, values + usage, now->values);
+                now->node_usage() = usage;
+                now->node_idx() = parent_idx;
+                now->node_height() = height;
+                now->touch();
+                if (parent == nullptr) { return; }
+                auto new_parent = now->node_parent();
+                if (new_parent == nullptr) {
+                    ASSERT(parent_idx == 0);
+                    new_parent = new BTreeNode<K, V, true, Search, Compare, B>(new_ctx);
+                    new_parent->child_at(0) = now;
+                    now->node_parent() = new_parent;
+                }
+                new_parent->child_at(new_parent->node_usage()) = now;
+                new_parent->node_usage() += 1;
+                return parent->traversal_copy(new_parent, new_ctx);
+            }
+
+            void traversal_copy(NodePtr now, Context &new_ctx) override {
+                ASSERT(dynamic_cast<BTreeNode *>(now)); // must of the same type
+                if constexpr (IsInternal) {
+                    if (usage + 1 == now->node_usage()) {
+                        return traversal_moveup(now, new_ctx);
+                    }
+                    auto child = children[now->node_usage()]->same_type(new_ctx);
+                    child->node_parent() = now;
+                    return children[now->node_usage()]->traversal_copy(child, new_ctx);
+                } else {
+                    return traversal_moveup(now, new_ctx);
+                }
+            };
+
+            static NodePtr singleton(NodePtr l, NodePtr r, K key, V value, Context &_ctx) {
+                auto node = new Inner(_ctx);
+                node->usage = 1;
+                node->height = l->node_height() + 1;
+                new(node->__values) V(std::move(value));  // no need for destroy, directly move
+                node->slots.place(0, 0, std::move(key));
+                node->touch();
+                _ctx.epoch++;
+                _ctx.reroots++;
+                node->children[0] = l;
+                l->node_idx() = 0;
+                l->node_parent() = node;
+                node->children[1] = r;
+                r->node_idx() = 1;
+                r->node_parent() = node;
+                return node;
+            }
+
+            std::optional<V> insert(const K &key, const V &value, NodePtr *root) override {
+                auto res = local_search(key);
+                if (res & FOUND) {
+                    this->write_begin();
+                    V original = std::move(values[res & FOUND_MASK]);
+                    std::destroy_at(values + (res & FOUND_MASK));
+                    new(values + (res & FOUND_MASK)) V(value);
+                    this->write_end();
+                    return {original};
+                }
+                auto position = res & GO_DOWN_MASK;
+                if constexpr (IsInternal) {
+                    return children[position]->insert(key, value, root);
+                } else {
+                    this->write_begin();
+                    uninitialized_move_back(values + position, values + usage);
+                    new(values + position) V(value);
+                    slots.place(usage, position, key);
+                    usage++;
+                    touch(position);
+                    if (usage < 2 * B - 1) {
+                        this->write_end();
+                    } else /* leaf if full */ {
+                        auto result = split();
+                        if (parent)
+                            parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value),
+                                          parent_idx, root);
+                        else {
+                            auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
+                                                  this->ctx);
+                            this->ctx.dispose(*root);
+                            *root = node;
+                        }
+                    }
+                    return std::nullopt;
+                }
+            }
+
+            void adopt(NodePtr l, NodePtr r, K key, V value, size_t position, NodePtr *root) override {
+                if constexpr (IsInternal) {
+                    this->ctx.dispose(children[position]);
+                }
+                graft(l, r, std::move(key), std::move(value), position, root);
+            }
+
+            // replace the child at `position` by `l`, `key` and `r`, without freeing the child that was there
+            void graft(NodePtr l, NodePtr r, K key, V value, size_t position, NodePtr *root) override {
+                this->write_begin();
+                uninitialized_move_back(values + position, values + usage);
+                if constexpr (IsInternal) {
+                    std::memmove(children + position + 1, children + position,
+                                 (usage + 1 - position) * sizeof(NodePtr));
+                    children[position] = l;
+                    l->node_parent() = this;
+                    children[position + 1] = r;
+                    r->node_parent() = this;
+                    for (int i = position; i < usage + 2; ++i) {
+                        children[i]->node_idx() = i;
+                    }
+                }
+                new(values + position) V(std::move(value));
+                slots.place(usage, position, std::move(key));
+                usage++;
+                touch(position);
+                if (usage < 2 * B - 1) {
+                    this->write_end();
+                } else {
+                    auto result = split();
+                    if (parent) {
+                        parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value), parent_idx,
+                                      root);
+                    } else {
+                        auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
+                                              this->ctx);
+                        this->ctx.dispose(*root);
+                        *root = node;
+                    }
+                }
+            }
+
+
+            void borrow_left(NodePtr from) {
+                ASSERT(dynamic_cast<BTreeNode *>(from));
+                ASSERT(parent); // root will never borrow
+                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
+                ASSERT(parent_idx > 0);
+                ASSERT(parent_idx == from->node_idx() + 1);
+                ASSERT(from->node_usage() - 1 >= B - 1);
+                ASSERT(usage + 1 >= B - 1);
+                auto from_node = static_cast<BTreeNode *>(from);
+                auto up = static_cast<Inner *>(parent);
+                restructured(from, this);
+                this->write_begin();
+                from->write_begin();
+                parent->write_begin();
+
+                uninitialized_move_back(values, values + usage);
+
+                /* get node from parent */
+                new(values) V(std::move(parent->value_at(parent_idx - 1)));
+                std::destroy_at(parent->values + parent_idx - 1);
+
+                /* update_parent */
+                auto from_usage = from->node_usage();
+                new(parent->values + parent_idx - 1) V(std::move(from->value_at(from_usage - 1)));
+                /* update from */
+                std::destroy_at(from->values + (from_usage - 1));
+
+                /* the last key of from replaces the separator, which comes down here */
+                slots.place(usage, 0, up->slots.exchange(up->usage, parent_idx - 1,
+                                                         from_node->slots.take(from_usage, from_usage - 1)));
+                usage++;
+                from->node_usage() -= 1;
+
+                /* take the child */
+                if constexpr (IsInternal) {
+                    std::memmove(children + 1, children, usage * sizeof(NodePtr));
+                    children[0] = from->child_at(from_usage);
+                    from->child_at(from_usage) = nullptr;
+                    children[0]->node_idx() = 0;
+                    children[0]->node_parent() = this;
+                    for (auto i = 1; i <= usage; ++i) {
+                        children[i]->node_idx() = i;
+                    }
+                }
+                touch();
+                from->touch();
+                parent->touch();
+                this->write_end();
+                from->write_end();
+                parent->write_end();
+            }
+
+            void borrow_right(NodePtr from) {
+                ASSERT(dynamic_cast<BTreeNode *>(from));
+                ASSERT(parent); // root will never borrow
+                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
+                ASSERT(parent_idx == 0); // only the first element call this
+                ASSERT(parent_idx < parent->node_usage());
+                ASSERT(parent_idx == from->node_idx() - 1);
+                ASSERT(from->node_usage() - 1 >= B - 1);
+                ASSERT(usage + 1 >= B - 1);
+
+                auto from_node = static_cast<BTreeNode *>(from);
+                auto up = static_cast<Inner *>(parent);
+                restructured(this, from);
+                this->write_begin();
+                from->write_begin();
+                parent->write_begin();
+                /* update this node */
+                new(values + usage) V(std::move(parent->value_at(parent_idx)));
+                std::destroy_at(parent->values + parent_idx);
+                /* the first key of from replaces the separator, which comes down here */
+                slots.place(usage, usage, up->slots.exchange(up->usage, parent_idx,
+                                                             from_node->slots.take(from_node->usage, 0)));
+                if constexpr (IsInternal) {
+                    children[usage + 1] = from_node->children[0];
+                    children[usage + 1]->node_parent() = this;
+                    children[usage + 1]->node_idx() = usage + 1;
+                }
+                usage++;
+
+                /* update parent */
+                new(parent->values + parent_idx) V(std::move(from_node->values[0]));
+                std::destroy_at(from_node->values);
+
+                /* update from node */
+                uninitialized_move_forward(from_node->values + 1, from_node->values + from_node->usage);
+
+                // memcpy should be good? but standards said UB if overlapped
+                if constexpr (IsInternal) {
+                    std::memmove(from_node->children, from_node->children + 1, from_node->usage * sizeof(NodePtr));
+                    from_node->children[from_node->usage] = nullptr;
+                    for (auto i = 0; i < from_node->usage; ++i) {
+                        from_node->children[i]->node_idx() = i;
+                    }
+                }
+                from_node->usage -= 1;
+                touch();
+                from_node->touch();
+                parent->touch();
+                this->write_end();
+                from->write_end();
+                parent->write_end();
+            }
+
+            static void merge(NodePtr a, NodePtr b, NodePtr *root) {
+                auto left = static_cast<BTreeNode *>(a);
+                auto right = static_cast<BTreeNode *>(b);
+                auto parent = static_cast<Inner *>(left->parent);
+                ASSERT(dynamic_cast<BTreeNode *>(a));
+                ASSERT(dynamic_cast<BTreeNode *>(b));
+                ASSERT((dynamic_cast <BTreeNode<K, V, true, Search, Compare, B> *> (left->parent))); // root will never borrow
+                ASSERT(left->parent == right->parent);
+                ASSERT(left->parent_idx == right->node_idx() - 1);
+                ASSERT(left->usage + right->usage + 1 < 2 * B - 1);
+                left->restructured(left, right);
+                left->write_begin();
+                right->write_begin(); // and never closed: it leaves the tree
+                parent->write_begin();
+
+                new(left->values + left->usage) V(std::move(parent->values[left->parent_idx]));
+                std::destroy_at(parent->values + left->parent_idx);
+                uninitialized_move_forward(parent->values + right->parent_idx, parent->values + parent->usage);
+                left->slots.place(left->usage, left->usage, parent->slots.take(parent->usage, left->parent_idx));
+                std::memmove(parent->children + right->parent_idx, parent->children + right->parent_idx + 1,
+                             (parent->usage - right->parent_idx) * sizeof(NodePtr));
+                parent->children[parent->usage--] = nullptr;
+
+
+                left->usage++;
+                std::uninitialized_move(right->values, right->values + right->usage, left->values + left->usage);
+                for (uint16_t i = 0; i < right->usage; ++i) {
+                    left->slots.place(left->usage + i, left->usage + i, right->slots.release(i));
+                }
+                std::destroy(right->values, right->values + right->usage);
+                right->slots.destroy(right->usage);
+
+                if constexpr (IsInternal) {
+                    std::memcpy(left->children + left->usage, right->children, (right->usage + 1) * sizeof(NodePtr));
+                    for (auto i = left->usage; i <= left->usage + right->usage; ++i) {
+                        left->children[i]->node_idx() = i;
+                        left->children[i]->node_parent() = left;
+                    }
+                }
+
+                left->usage += right->usage;
+                right->usage = 0;
+                left->ctx.dispose(right);
+                left->touch();
+                parent->touch();
+                left->write_end();
+
+                for (auto i = left->parent_idx; i <= parent->usage; ++i) {
+                    parent->children[i]->node_idx() = i;
+                }
+
+                if (parent->usage == 0) /* only possible at root or B == 2 */ {
+                    ASSERT(parent == *root);
+                    parent->usage = 0;
+                    left->ctx.dispose(parent);
+                    left->parent = nullptr;
+                    *root = left;
+                    left->ctx.reroots++;
+                    return;
+                }
+
+                parent->write_end();
+                parent->fix_underflow(root);
+            }
+
+            void fix_underflow(NodePtr *root) override {
+                if (usage >= B - 1 || !parent) return;
+                if (parent_idx) {
+                    auto target = parent->child_at(parent_idx - 1);
+                    if (target->node_usage() > B - 1) {
+                        borrow_left(target);
+                    } else {
+                        merge(target, this, root);
+                    }
+                } else {
+                    auto target = parent->child_at(parent_idx + 1);
+                    if (target->node_usage() > B - 1) {
+                        borrow_right(target);
+                    } else {
+                        merge(this, target, root);
+                    }
+                }
+            }
+
+#ifdef DEBUG_MODE
+
+            void display(size_t ident) override {
+                std::string idents(ident ? ident - 1 : 0, '-');
+                if (ident) idents.push_back('>');
+                if (ident) idents.push_back(' ');
+                {
+                    unsigned i = 0;
+                    for (; i < usage; ++i) {
+                        std::cout << " " << std::setw(4) << slots.get(i);
+                    }
+                    for (; i < 2 * B - 2; ++i) {
+                        std::cout << " " << std::setw(4) << "_";
+                    }
+                }
+                std::cout << std::endl;
+                if constexpr (IsInternal) {
+                    for (auto i = 0; i <= usage; ++i) {
+                        children[i]->display(ident + 4);;
+                    }
+                }
+            }
+
+#endif
+
+            typename Node::iterator min() override {
+                if constexpr(IsInternal) {
+                    return children[0]->min();
+                } else {
+                    return typename Node::iterator{
+                            .idx = 0,
+                            .node = this
+                    };
+                }
+            }
+
+            typename Node::iterator max() override {
+                if constexpr(IsInternal) {
+                    return children[usage]->max();
+                } else {
+                    return typename Node::iterator{
+                            .idx = uint16_t(usage - 1u),
+                            .node = this
+                    };
+                }
+            }
+
+            NodePtr &child_at(size_t i) override {
+                if constexpr (IsInternal) {
+                    return children[i];
+                } else {
+                    std::abort();
+                }
+            }
+
+            inline typename Node::KeyRef key_at(size_t i) override {
+                return slots.get(i);
+            }
+
+            inline bool precedes(size_t i, const K &key) override {
+                if constexpr (requires { slots.order(i, key); }) return slots.order(i, key) < 0;
+                else return this->ctx.comp(slots.get(i), key);
+            }
+
+            inline bool follows(size_t i, const K &key) override {
+                if constexpr (requires { slots.order(i, key); }) return slots.order(i, key) > 0;
+                else return this->ctx.comp(key, slots.get(i));
+            }
+
+            inline const K &separator_at(size_t i) override {
+                if constexpr (!Slots::encoded) {
+                    return slots.get(i);
+                } else {
+                    std::abort();
+                }
+            }
+
+            void drop_entries() override {
+                slots.destroy(usage);
+                std::destroy(values, values + usage);
+                usage = 0;
+            }
+
+            inline V &value_at(size_t i) override {
+                return values[i];
+            }
+
+            typename Node::iterator predecessor(uint16_t idx) override {
+                if constexpr (IsInternal) {
+                    return children[idx]->max();
+                } else {
+                    if (idx)
+                        return typename Node::iterator{
+                                .idx = uint16_t(idx - 1u),
+                                .node = this
+                        };
+                    else {
+                        NodePtr node = this;
+                        while (node->node_parent() && node->node_idx() == 0) {
+                            node = node->node_parent();
+                        }
+                        if (node->node_parent()) {
+                            return typename Node::iterator{
+                                    .idx = uint16_t(node->node_idx() - 1u),
+                                    .node = node->node_parent()
+                            };
+                        } else {
+                            return typename Node::iterator{
+                                    .idx = 0,
+                                    .node = nullptr
+                            };
+                        }
+                    }
+                }
+            }
+
+            typename Node::iterator successor(uint16_t idx) override {
+                if constexpr (IsInternal) {
+                    return children[idx + 1]->min();
+                } else {
+                    if (idx < usage - 1)
+                        return typename Node::iterator{
+                                .idx = uint16_t(idx + 1u),
+                                .node = this
+                        };
+                    else {
+                        NodePtr node = this;
+                        while (node->node_parent() && node->node_idx() == node->node_parent()->node_usage()) {
+                            node = node->node_parent();
+                        }
+                        if (node->node_parent()) {
+                            return typename Node::iterator{
+                                    .idx = node->node_idx(),
+                                    .node = node->node_parent()
+                            };
+                        } else {
+                            return typename Node::iterator{
+                                    .idx = 0,
+                                    .node = nullptr
+                            };
+                        }
+                    }
+                }
+            }
+
+            ~BTreeNode() override {
+#ifdef DEBUG_MODE
+                alive_node--;
+#endif
+                slots.destroy(usage);
+                std::destroy(values, values + usage);
+                if constexpr(IsInternal) {
+                    if (usage)
+                        for (auto i = 0; i <= usage; ++i) {
+                            delete children[i];
+                        }
+                }
+            }
+
+            std::pair<K, V> erase(uint16_t index, NodePtr *root) override {
+                if constexpr (IsInternal) {
+                    auto pred = children[index]->max();
+                    auto leaf = static_cast<Leaf *>(pred.node);
+                    /* the separator moves down to the predecessor, so do the bounds of the children around it */
+                    this->ctx.epoch++;
+                    if (height > this->ctx.watch_height) {
+                        K lower = leaf->slots.get(pred.idx);
+                        this->ctx.widen(&lower, &slots.get(index));
+                    }
+                    this->write_begin();
+                    pred.node->write_begin();
+                    K separator = slots.exchange(usage, index, leaf->slots.release(pred.idx));
+                    leaf->slots.exchange(leaf->usage, pred.idx, std::move(separator));
+                    std::swap(values[index], pred.node->value_at(pred.idx));
+                    touch(index);
+                    this->write_end();
+                    pred.node->write_end();
+                    return pred.node->erase(pred.idx, root);
+                } else {
+                    this->write_begin();
+                    std::pair<K, V> result(slots.take(usage, index), std::move(values[index]));
+                    std::destroy_at(values + index);
+                    uninitialized_move_forward(values + index + 1, values + usage);
+                    usage--;
+                    touch(usage); // nothing moved in
+                    this->write_end();
+                    fix_underflow(root);
+                    return result;
+                }
+            }
+        };
+
+    }
+
+    /*
+     * How keys and values are written to logs and files: trivially copyable types as their bytes (in host
+     * byte order), strings behind a 64-bit length. Specialize for other types; `get` returns nothing when
+     * the input ends early.
+     */
+    template<typename T, typename = void>
+    struct codec;
+
+    template<typename T>
+    struct codec<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+        static constexpr size_t most = sizeof(T); // bytes of the longest encoding
+
+        static void put(std::string &out, const T &value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        static std::optional<T> get(const char *&at, const char *end) {
+            if (size_t(end - at) < sizeof(T)) return std::nullopt;
+            T value;
+            std::memcpy(&value, at, sizeof(T));
+            at += sizeof(T);
+            return value;
+        }
+    };
+
+    template<>
+    struct codec<std::string> {
+        // strings up to 64 MiB, which bounds what a reader of a framed image allocates for one chunk
+        static constexpr size_t most = sizeof(uint64_t) + (size_t(1) << 26);
+
+        static void put(std::string &out, const std::string &value) {
+            codec<uint64_t>::put(out, value.size());
+            out.append(value);
+        }
+
+        static std::optional<std::string> get(const char *&at, const char *end) {
+            auto length = codec<uint64_t>::get(at, end);
+            if (!length || size_t(end - at) < *length) return std::nullopt;
+            std::string value(at, *length);
+            at += *length;
+            return value;
+        }
+    };
+
+    namespace __btree_impl {
+        constexpr std::array<uint32_t, 256> crc32_table = [] {
+            std::array<uint32_t, 256> table{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            return table;
+        }();
+
+        // `crc` of the bytes before, to go on over data that arrives in pieces
+        inline uint32_t crc32(const char *data, size_t length, uint32_t crc = 0) {
+            uint32_t c = crc ^ 0xFFFFFFFFu;
+            for (size_t i = 0; i < length; ++i) c = crc32_table[(c ^ uint8_t(data[i])) & 0xFF] ^ (c >> 8);
+            return c ^ 0xFFFFFFFFu;
+        }
+
+        inline bool write_all(int fd, const std::string &data) {
+            for (size_t done = 0; done < data.size();) {
+                auto n = ::write(fd, data.data() + done, data.size() - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        // sync the directory holding `path`, so that a file renamed there stays renamed after a crash
+        inline bool sync_parent(const std::string &path) {
+            auto slash = path.rfind('/');
+            auto dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+            int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0) return false;
+            bool ok = ::fsync(fd) == 0;
+            return ::close(fd) == 0 && ok;
+        }
+    }
+
+    /*
+     * A fixed set of threads running one job at a time: `run(job)` calls job(0) .. job(size() - 1), part 0 on
+     * the calling thread, and returns once all parts are done.
+     */
+    class WorkerPool {
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable wake, done;
+        std::function<void(size_t)> job;
+        size_t generation = 0;
+        size_t pending = 0;
+        bool stopping = false;
+
+        void serve(size_t part) {
+            size_t seen = 0;
+            while (true) {
+                std::function<void(size_t)> current;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    wake.wait(guard, [&] { return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                    current = job;
+                }
+                current(part);
+                std::lock_guard<std::mutex> guard(lock);
+                if (--pending == 0) done.notify_one();
+            }
+        }
+
+    public:
+        explicit WorkerPool(unsigned threads) {
+            for (unsigned i = 1; i < threads; ++i) {
+                workers.emplace_back([this, i] { serve(i); });
+            }
+        }
+
+        WorkerPool(const WorkerPool &) = delete;
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto &worker: workers) worker.join();
+        }
+
+        size_t size() {
+            return workers.size() + 1;
+        }
+
+        void run(std::function<void(size_t)> f) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                job = f;
+                pending = workers.size();
+                generation++;
+            }
+            wake.notify_all();
+            f(0);
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&] { return pending == 0; });
+        }
+    };
+
+    /*
+     * Puts and erasures collected for one `BTree::apply`; a later operation on a key overrides earlier ones.
+     */
+    template<typename K, typename V>
+    class WriteBatch {
+        // a missing value marks an erasure
+        std::vector<std::pair<K, std::optional<V>>> ops;
+
+        template<typename, typename, unsigned, size_t, typename>
+        friend class BTree;
+
+    public:
+        void put(const K &key, const V &value) {
+            ops.emplace_back(key, value);
+        }
+
+        void erase(const K &key) {
+            ops.emplace_back(key, std::nullopt);
+        }
+
+        // calls `f(key, value)` for every operation in the order given, with no value for an erasure
+        template<typename F>
+        void for_each(F f) const {
+            for (auto &[key, value]: ops) f(key, value);
+        }
+
+        size_t size() const {
+            return ops.size();
+        }
+
+        bool empty() const {
+            return ops.empty();
+        }
+
+        void clear() {
+            ops.clear();
+        }
+    };
+
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+    class BTree {
+
+        using Node = __btree_impl::AbstractBTNode<K, V, Search, B, Compare>;
+        using Inner = __btree_impl::BTreeNode<K, V, true, Search, Compare, B>;
+        using Leaf = __btree_impl::BTreeNode<K, V, false, Search, Compare, B>;
+        using Context = typename Node::Context;
+        size_t _size = 0;
+        Node *root = nullptr;
+
+        // nodes keep a reference to the context, so it stays put when the tree is moved
+        std::unique_ptr<Context> ctx;
+
+        std::vector<Node *> radix;
+        unsigned radix_shift = 0;
+        size_t radix_reroots = 0;
+
+        static constexpr bool ordered_integers =
+                std::is_integral_v<K> && (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+        static constexpr bool ordered_numbers = __btree_impl::interpolable<K, Compare>;
+
+        // a segment predicts the leaf of `key` as `rank + slope * (key - first)`
+        struct Segment {
+            K first;
+            double slope;
+            size_t rank;
+        };
+
+        std::vector<Segment> segments;
+        std::vector<K> fences; // the first key of every leaf, in order
+        std::vector<Node *> leaves;
+        size_t model_error = 0;
+
+        std::unique_ptr<__btree_impl::hash_index<K, Node, Compare>> hashed;
+
+        std::unique_ptr<__btree_impl::bloom_filter<K>> bloom;
+        size_t bloom_bits = 0;
+        size_t bloom_erased = 0;
+
+        // node versions replaced while a snapshot could see them, with the version that replaced them
+        std::vector<std::pair<Node *, size_t>> retired;
+
+        // the state the next checkpoint is a delta on: its entries, its place in the chain (0 for the image,
+        // then one more per delta) and the CRC-32 of the whole image or delta that recorded it
+        size_t checkpointed = 0;
+        uint64_t generation = 0;
+        uint32_t lineage = 0;
+
+        void rebuild_bloom() {
+            bloom = std::make_unique<__btree_impl::bloom_filter<K>>(std::max<size_t>(2 * _size, 1024), bloom_bits);
+            bloom_erased = 0;
+            for (auto iter = begin(); iter != end(); iter = iter.node->successor(iter.idx)) {
+                bloom->add(iter.node->key_at(iter.idx));
+            }
+        }
+
+        inline size_t radix_slot(const K &key) {
+            using U = std::make_unsigned_t<K>;
+            U bits = U(key);
+            if constexpr (std::is_signed_v<K>) {
+                bits ^= U(U(1) << (8 * sizeof(K) - 1));
+            }
+            return size_t(bits >> radix_shift);
+        }
+
+        /*
+         * Assign the slots in [first, last), all of which lie inside the key range of `node`: slots inside the
+         * range of a child go to that child (if it is still at or above the watched height), slots holding one
+         * of the separators of `node` stay here.
+         */
+        void fill_radix(Node *node, size_t first, size_t last) {
+            auto usage = node->node_usage();
+            if (node->node_height() <= ctx->watch_height) {
+                std::fill(radix.begin() + first, radix.begin() + last, node);
+                return;
+            }
+            auto lo = first;
+            for (uint16_t i = 0; i <= usage && lo < last; ++i) {
+                auto hi = last;
+                if (i < usage) {
+                    hi = radix_slot(node->key_at(i));
+                    if (hi < lo) continue; // the separator shares a slot already assigned
+                    hi = std::min(hi, last);
+                }
+                if (lo < hi) {
+                    fill_radix(node->child_at(i), lo, hi);
+                }
+                if (hi < last) {
+                    radix[hi] = node;
+                }
+                lo = hi + 1;
+            }
+        }
+
+        void rebuild_radix() {
+            if (root == nullptr) {
+                std::fill(radix.begin(), radix.end(), nullptr);
+            } else {
+                fill_radix(root, 0, radix.size());
+            }
+            radix_reroots = ctx->reroots;
+            ctx->changed = false;
+        }
+
+        // patch the slots of the key range restructured by the last operation
+        inline void sync_radix() {
+            if constexpr (ordered_integers) {
+                if (radix.empty()) return;
+                if (radix_reroots != ctx->reroots) {
+                    rebuild_radix();
+                } else if (ctx->changed) {
+                    auto first = ctx->changed_lo ? radix_slot(*ctx->changed_lo) : 0;
+                    auto last = ctx->changed_hi ? radix_slot(*ctx->changed_hi) + 1 : radix.size();
+                    fill_radix(root, first, last);
+                    ctx->changed = false;
+                }
+            }
+        }
+
+        // any write that adds or removes an entry moves entries between nodes, so the model is simply dropped
+        inline void invalidate_model() {
+            if (!segments.empty()) {
+                segments.clear();
+                fences.clear();
+                leaves.clear();
+            }
+        }
+
+        /*
+         * The leaf predicted by the learned model, found by a bounded search of the fences around the prediction
+         * (a prediction is capped at the last leaf of its segment, so the window holds the leaf whenever the
+         * model is within its error), then a search inside the leaf. A key between two leaves can only be the
+         * separator above them, the successor of the last entry of the leaf.
+         */
+        typename Node::iterator model_find(const K &key) {
+            auto seg = std::upper_bound(segments.begin(), segments.end(), key,
+                                        [](const K &k, const Segment &s) { return k < s.first; });
+            if (seg == segments.begin()) return end();
+            auto last = (seg == segments.end() ? fences.size() : seg->rank) - 1;
+            --seg;
+            auto guess = double(seg->rank) + seg->slope * (double(key) - double(seg->first));
+            auto pos = size_t(std::clamp(guess, double(seg->rank), double(last)));
+            auto lo = fences.begin() + (pos > model_error + 1 ? pos - model_error - 1 : 0);
+            auto hi = fences.begin() + std::min(fences.size(), pos + model_error + 2);
+            auto it = std::upper_bound(lo, hi, key);
+            if ((it == lo && lo != fences.begin()) || (it == hi && hi != fences.end() && !(key < *hi))) {
+                it = std::upper_bound(fences.begin(), fences.end(), key); // outside the window after all
+            }
+            auto leaf = leaves[it - fences.begin() - 1];
+            auto found = leaf->find(key);
+            if (found.node) return found;
+            uint16_t back = leaf->node_usage() - 1;
+            if (!ctx->comp(leaf->key_at(back), key)) return end();
+            auto next = leaf->successor(back);
+            if (!next.node) return end();
+            auto &separator = next.node->separator_at(next.idx);
+            return ctx->comp(key, separator) || ctx->comp(separator, key) ? end() : next;
+        }
+
+        inline Node *lookup_start(const K &key) {
+            if constexpr (ordered_integers) {
+                if (!radix.empty()) {
+                    return radix[radix_slot(key)];
+                }
+            }
+            return root;
+        }
+
+        // largest and smallest number of entries a non-root subtree of the given height may hold
+        static constexpr size_t most_entries(uint8_t height) {
+            return height == 0 ? 2 * B - 2 : (2 * B - 1) * (most_entries(height - 1) + 1) - 1;
+        }
+
+        static constexpr size_t least_entries(uint8_t height) {
+            return height == 0 ? B - 1 : B * (least_entries(height - 1) + 1) - 1;
+        }
+
+        // the tallest height whose most_entries is still exact in a size_t
+        static constexpr uint8_t tallest = [] {
+            uint8_t height = 0;
+            while (most_entries(height) + 1 <= SIZE_MAX / (2 * B - 1)) height++;
+            return height;
+        }();
+
+        /*
+         * Build a subtree of exactly n entries taken from `next()` in key order. The shape follows from n
+         * alone: an internal node takes as few children as fit the entries (but at least B, or 2 at the root)
+         * and spreads the entries evenly, which keeps every child between least_entries and most_entries.
+         * `next()` returns an optional entry; at the first nullopt the build stops with `built` false, leaving
+         * a partial subtree that is only fit to be deleted.
+         */
+        template<typename Next>
+        Node *build(uint8_t height, size_t n, bool is_root, Next &next, bool &built) {
+            if (height == 0) {
+                auto leaf = new __btree_impl::BTreeNode<K, V, false, Search, Compare, B>(*ctx);
+                for (size_t i = 0; i < n; ++i) {
+                    auto entry = next();
+                    if (!entry) {
+                        built = false;
+                        break;
+                    }
+                    leaf->slots.place(i, i, std::move(entry->first));
+                    new(leaf->values + i) V(std::move(entry->second));
+                    leaf->usage = i + 1;
+                }
+                leaf->touch();
+                return leaf;
+            }
+            auto node = new __btree_impl::BTreeNode<K, V, true, Search, Compare, B>(*ctx);
+            auto child_most = most_entries(height - 1);
+            size_t count = std::max<size_t>((n + child_most + 1) / (child_most + 1), is_root ? 2 : B);
+            auto rest = n - (count - 1);
+            for (size_t i = 0; i < count; ++i) {
+                auto child = build(height - 1, rest / count + (i < rest % count), false, next, built);
+                node->children[i] = child;
+                child->node_parent() = node;
+                child->node_idx() = i;
+                decltype(next()) entry;
+                if (built && i + 1 < count && !(entry = next())) built = false;
+                if (!built) {
+                    // the destructor only visits the children of a node holding entries
+                    if (i == 0) delete child;
+                    break;
+                }
+                if (i + 1 < count) {
+                    node->slots.place(i, i, std::move(entry->first));
+                    new(node->values + i) V(std::move(entry->second));
+                    node->usage = i + 1;
+                }
+            }
+            node->height = height;
+            node->touch();
+            return node;
+        }
+
+        // false, with the tree left empty, if `next()` ran out before n entries or no tree holds n of them
+        template<typename Next>
+        bool assign_sorted(size_t n, Next next) {
+            if (n == 0) return true;
+            if (n > most_entries(tallest)) return false;
+            uint8_t height = 0;
+            while (most_entries(height) < n) height++;
+            bool built = true;
+            auto top = build(height, n, true, next, built);
+            if (!built) {
+                delete top;
+                return false;
+            }
+            _size = n;
+            root = top;
+            ctx->reroots++;
+            return true;
+        }
+
+        static constexpr char image_magic[8] = {'B', 'T', 'R', 'E', 'E', 'I', 'M', '1'};
+        static constexpr char delta_magic[8] = {'B', 'T', 'R', 'E', 'E', 'D', 'L', '2'};
+        static constexpr size_t image_chunk = 1 << 16; // bytes of records per checksummed chunk
+        // longest record of an image or a delta: a kind, then two keys or a key and a value
+        static constexpr size_t image_record = 1 + 2 * codec<K>::most + codec<V>::most;
+        static constexpr uint8_t delta_copy = 0, delta_literal = 1, delta_end = 2; // kinds of delta records
+
+        static auto writing(std::ostream &out) {
+            return [&](const std::string &data) { return bool(out.write(data.data(), data.size())); };
+        }
+
+        static auto writing(int fd) {
+            return [fd](const std::string &data) { return __btree_impl::write_all(fd, data); };
+        }
+
+        static auto reading(std::istream &in) {
+            return [&](char *data, size_t n) { return bool(in.read(data, n)); };
+        }
+
+        static auto reading(int fd) {
+            return [fd](char *data, size_t n) {
+                for (size_t done = 0; done < n;) {
+                    auto got = ::read(fd, data + done, n - done);
+                    if (got < 0 && errno == EINTR) continue;
+                    if (got <= 0) return false;
+                    done += got;
+                }
+                return true;
+            };
+        }
+
+        // `header` behind its CRC-32, then the records `body(chunk, more)` appends to `chunk`, calling `more()`
+        // after each one, cut into chunks of about `image_chunk` bytes behind their length and CRC-32;
+        // `written` gets the CRC-32 of everything written
+        template<typename Sink, typename Body>
+        static bool write_framed(Sink raw, std::string header, Body body, uint32_t &written) {
+            written = 0;
+            auto sink = [&](const std::string &data) {
+                written = __btree_impl::crc32(data.data(), data.size(), written);
+                return raw(data);
+            };
+            codec<uint32_t>::put(header, __btree_impl::crc32(header.data(), header.size()));
+            if (!sink(header)) return false;
+            std::string chunk(8, '\0'); // length and checksum go in front
+            auto flush = [&] {
+                uint32_t frame[2] = {uint32_t(chunk.size() - 8), __btree_impl::crc32(chunk.data() + 8, chunk.size() - 8)};
+                std::memcpy(chunk.data(), frame, sizeof(frame));
+                bool ok = sink(chunk);
+                chunk.resize(8);
+                return ok;
+            };
+            // a chunk ends with the record that takes it to image_chunk bytes, so none is longer than
+            // image_chunk + image_record and a reader can refuse a longer length before allocating it
+            auto more = [&] {
+                return chunk.size() < image_chunk || (chunk.size() - 8 <= image_chunk + image_record && flush());
+            };
+            return body(chunk, more) && (chunk.size() == 8 || flush());
+        }
+
+        // `source` keeping the CRC-32 of everything read through it in `crc`
+        template<typename Source>
+        static auto summing(Source &source, uint32_t &crc) {
+            crc = 0;
+            return [&](char *data, size_t n) {
+                if (!source(data, n)) return false;
+                crc = __btree_impl::crc32(data, n, crc);
+                return true;
+            };
+        }
+
+        // read a header of `size` bytes that starts with `magic` and ends with the CRC-32 of the rest
+        template<typename Source>
+        static bool read_header(Source &source, const char *magic, char *header, size_t size) {
+            if (!source(header, size) || std::memcmp(header, magic, 8) != 0) return false;
+            const char *at = header + size - 4;
+            return *codec<uint32_t>::get(at, header + size) == __btree_impl::crc32(header, size - 4);
+        }
+
+        // once [at, end) is used up, make it the next chunk, checked against its CRC-32
+        template<typename Source>
+        static bool refill(Source &source, std::string &chunk, const char *&at, const char *&end) {
+            while (at == end) {
+                char frame[8];
+                if (!source(frame, sizeof(frame))) return false;
+                const char *f = frame;
+                auto length = *codec<uint32_t>::get(f, frame + 8);
+                auto crc = *codec<uint32_t>::get(f, frame + 8);
+                if (length > image_chunk + image_record) return false;
+                chunk.resize(length);
+                if (!source(chunk.data(), length) || __btree_impl::crc32(chunk.data(), length) != crc) return false;
+                at = chunk.data();
+                end = at + length;
+            }
+            return true;
+        }
+
+        // the changes of this subtree since the last checkpoint, in key order: an unchanged subtree or entry as
+        // the range of keys it held then, which nothing else held, and the entries of changed nodes as they are.
+        // `edge()` marks entering and leaving a changed node; ranges on either side may have been apart before.
+        template<typename Copy, typename Literal, typename Edge>
+        static bool changes(Node *node, Copy &copy, Literal &literal, Edge &edge) {
+            if (!node->dirty && !node->dirty_below) {
+                auto lo = node->min(), hi = node->max();
+                return copy(lo.node->key_at(lo.idx), hi.node->key_at(hi.idx));
+            }
+            bool internal = node->node_height() > 0;
+            if (node->dirty && !edge()) return false;
+            for (uint16_t i = 0; i < node->node_usage(); ++i) {
+                if (internal && !changes(node->child_at(i), copy, literal, edge)) return false;
+                if (!(node->dirty ? literal(node->key_at(i), node->value_at(i))
+                                  : copy(node->key_at(i), node->key_at(i)))) {
+                    return false;
+                }
+            }
+            if (internal && !changes(node->child_at(node->node_usage()), copy, literal, edge)) return false;
+            return !node->dirty || edge();
+        }
+
+        static void settle(Node *node) {
+            if (!node->dirty && !node->dirty_below) return;
+            node->dirty = node->dirty_below = false;
+            if (node->node_height() == 0) return;
+            for (uint16_t i = 0; i <= node->node_usage(); ++i) settle(node->child_at(i));
+        }
+
+        // the tree as it is now, recorded as the given link of a chain, is what the next checkpoint is a delta on
+        void settled(uint64_t link, uint32_t crc) {
+            if (root) settle(root);
+            checkpointed = _size;
+            generation = link;
+            lineage = crc;
+        }
+
+        // an image of the `n` entries `each(put)` passes to `put(key, value)` in key order; `put` returns false
+        // after a write error, and `each` stops there
+        template<typename Sink, typename Each>
+        static bool write_image(Sink sink, size_t n, Each each, uint32_t &written) {
+            std::string header(image_magic, sizeof(image_magic));
+            codec<uint64_t>::put(header, n);
+            return write_framed(sink, header, [&](std::string &chunk, auto &more) {
+                auto put = [&](const K &key, const V &value) {
+                    codec<K>::put(chunk, key);
+                    codec<V>::put(chunk, value);
+                    return more();
+                };
+                return each(put);
+            }, written);
+        }
+
+        template<typename Sink>
+        bool save_to(Sink sink) {
+            uint32_t written;
+            bool ok = write_image(sink, _size, [&](auto &put) { return !root || Snapshot::walk(root, put); }, written);
+            if (ok) settled(0, written);
+            return ok;
+        }
+
+        template<typename Source>
+        static std::optional<BTree> load_from(Source raw, Compare comp) {
+            uint32_t crc;
+            auto source = summing(raw, crc);
+            char header[sizeof(image_magic) + 12];
+            if (!read_header(source, image_magic, header, sizeof(header))) return std::nullopt;
+            const char *at = header + sizeof(image_magic), *end = header + sizeof(header);
+            auto n = *codec<uint64_t>::get(at, end);
+            std::string chunk;
+            at = end = nullptr;
+            std::optional<std::pair<K, V>> last;
+            // decode the next entry into `last`, reading the next chunk when this one is used up
+            auto advance = [&] {
+                if (!refill(source, chunk, at, end)) return false;
+                auto key = codec<K>::get(at, end);
+                auto value = key ? codec<V>::get(at, end) : std::nullopt;
+                if (!value || (last && !comp(last->first, *key))) return false;
+                last.emplace(std::move(*key), std::move(*value));
+                return true;
+            };
+            BTree tree(comp);
+            // the build stops at the first entry that cannot be read, so a short image costs what it holds
+            bool built = tree.assign_sorted(n, [&]() -> std::optional<std::pair<K, V>> {
+                if (!advance()) return std::nullopt;
+                return last;
+            });
+            if (!built || at != end) return std::nullopt;
+            tree.settled(0, crc);
+            return tree;
+        }
+
+        template<typename Sink>
+        bool checkpoint_to(Sink sink) {
+            std::string header(delta_magic, sizeof(delta_magic));
+            codec<uint64_t>::put(header, generation + 1);
+            codec<uint32_t>::put(header, lineage);
+            codec<uint64_t>::put(header, checkpointed);
+            codec<uint64_t>::put(header, _size);
+            uint32_t written;
+            bool ok = write_framed(sink, header, [&](std::string &chunk, auto &more) {
+                // ranges that follow one another through unchanged nodes only were adjacent before too
+                std::optional<std::pair<K, K>> run;
+                auto edge = [&] {
+                    if (!run) return true;
+                    codec<uint8_t>::put(chunk, delta_copy);
+                    codec<K>::put(chunk, run->first);
+                    codec<K>::put(chunk, run->second);
+                    run.reset();
+                    return more();
+                };
+                auto copy = [&](const K &lo, const K &hi) {
+                    if (run) run->second = hi;
+                    else run.emplace(lo, hi);
+                    return true;
+                };
+                auto literal = [&](const K &key, const V &value) {
+                    if (!edge()) return false;
+                    codec<uint8_t>::put(chunk, delta_literal);
+                    codec<K>::put(chunk, key);
+                    codec<V>::put(chunk, value);
+                    return more();
+                };
+                if (_size && !(changes(root, copy, literal, edge) && edge())) return false;
+                codec<uint8_t>::put(chunk, delta_end);
+                return true;
+            }, written);
+            if (ok) settled(generation + 1, written);
+            return ok;
+        }
+
+        // the tree a delta written by `checkpoint` turns this one into, or nothing if it is not a delta on it:
+        // the delta names the link of the chain it follows by its generation and the CRC-32 of that link
+        template<typename Source>
+        std::optional<BTree> apply_delta(Source raw) {
+            uint32_t crc;
+            auto source = summing(raw, crc);
+            char header[sizeof(delta_magic) + 32];
+            if (!read_header(source, delta_magic, header, sizeof(header))) return std::nullopt;
+            const char *at = header + sizeof(delta_magic), *end = header + sizeof(header);
+            auto link = *codec<uint64_t>::get(at, end);
+            auto follows = *codec<uint32_t>::get(at, end);
+            auto base = *codec<uint64_t>::get(at, end);
+            auto n = *codec<uint64_t>::get(at, end);
+            if (link != generation + 1 || follows != lineage || base != _size) return std::nullopt;
+            // a delta is small next to the tree: it is read whole, so that a bad one is refused before building
+            struct Range {
+                K lo, hi;
+                std::optional<V> value; // of a changed entry, whose range is its key alone
+            };
+            std::vector<Range> ranges;
+            std::string chunk;
+            at = end = nullptr;
+            while (true) {
+                if (!refill(source, chunk, at, end)) return std::nullopt;
+                auto kind = *codec<uint8_t>::get(at, end);
+                if (kind == delta_end) break;
+                auto lo = codec<K>::get(at, end);
+                if (!lo || kind > delta_literal) return std::nullopt;
+                if (kind == delta_copy) {
+                    auto hi = codec<K>::get(at, end);
+                    if (!hi) return std::nullopt;
+                    ranges.push_back(Range{std::move(*lo), std::move(*hi), std::nullopt});
+                } else {
+                    auto value = codec<V>::get(at, end);
+                    if (!value) return std::nullopt;
+                    ranges.push_back(Range{*lo, *lo, std::move(*value)});
+                }
+            }
+            if (at != end) return std::nullopt;
+            auto range = ranges.begin();
+            auto from = this->end(); // next entry of the range being copied
+            const K *upto = nullptr;  // and the last key of that range
+            std::optional<std::pair<K, V>> last;
+            auto copying = [&] { return upto && from.node && !from.node->follows(from.idx, *upto); };
+            // the next entry into `last`; copied ranges must start and end at entries of this tree
+            auto advance = [&] {
+                std::optional<std::pair<K, V>> next;
+                if (copying()) {
+                    next.emplace(from.node->key_at(from.idx), from.node->value_at(from.idx));
+                    ++from;
+                } else if (range == ranges.end() || (upto && ctx->comp(last->first, *upto))) {
+                    return false;
+                } else if (range->value) {
+                    upto = nullptr;
+                    next.emplace(range->lo, *range->value);
+                    ++range;
+                } else {
+                    from = lower_bound(range->lo);
+                    if (!from.node || ctx->comp(range->lo, from.node->key_at(from.idx))) return false;
+                    upto = &range->hi;
+                    next.emplace(from.node->key_at(from.idx), from.node->value_at(from.idx));
+                    ++from;
+                    ++range;
+                }
+                if (last && !ctx->comp(last->first, next->first)) return false;
+                last = std::move(next);
+                return true;
+            };
+            BTree tree(ctx->comp);
+            bool built = tree.assign_sorted(n, [&]() -> std::optional<std::pair<K, V>> {
+                if (!advance()) return std::nullopt;
+                return last;
+            });
+            if (!built || copying() || range != ranges.end() || (upto && ctx->comp(last->first, *upto))) {
+                return std::nullopt;
+            }
+            tree.settled(link, crc);
+            return tree;
+        }
+
+        BTree collect(std::vector<typename Node::iterator> &picked) {
+            BTree result(ctx->comp);
+            auto iter = picked.begin();
+            result.assign_sorted(picked.size(), [&] { return std::optional<std::pair<K, V>>(**iter++); });
+            return result;
+        }
+
+        inline bool less(typename Node::iterator a, typename Node::iterator b) {
+            return ctx->comp(a.node->key_at(a.idx), b.node->key_at(b.idx));
+        }
+
+        // |small| probes into the larger tree beat walking it in lockstep
+        static inline bool skewed(size_t small, size_t large) {
+            return small * std::bit_width(large) < large;
+        }
+
+        // free a node whose children (if any) belong to another node
+        static void release(Node *node) {
+            node->drop_entries();
+            node->ctx.dispose(node);
+        }
+
+        // the node itself if no snapshot can see it, otherwise a copy replacing it in the current version
+        Node *own(Node *node) {
+            if (node->version >= ctx->frozen_below.load(std::memory_order_acquire)) return node;
+            node->write_begin(); // it leaves the current version: optimistic readers on it start over
+            auto copy = node->clone();
+            if (node == root) {
+                root = copy;
+                ctx->reroots++; // a leaf root sits in every radix slot, below the watched height
+            }
+            retired.emplace_back(node, ctx->version);
+            return copy;
+        }
+
+        // own the sibling `fix_underflow` would borrow from or merge with
+        void own_sibling(Node *parent, Node *child) {
+            auto idx = child->node_idx();
+            own(parent->child_at(idx ? idx - 1 : idx + 1));
+        }
+
+        /*
+         * Copy every node an insert (or erase) of `key` may modify out of the live snapshots, top-down so that
+         * each copy is linked into a parent that is already private: the search path, and for an erase also
+         * the path to the predecessor that replaces an internal entry and the sibling each node of the path
+         * would borrow from or merge with. Returns whether anything was copied.
+         */
+        bool unshare(const K &key, bool erasing) {
+            if (!root || ctx->frozen_below.load(std::memory_order_acquire) == 0) return false;
+            auto before = retired.size();
+            auto node = own(root);
+            typename Node::iterator found{.idx = 0, .node = nullptr};
+            while (auto child = node->descend(key, found)) {
+                if (erasing) own_sibling(node, child);
+                node = own(child);
+            }
+            if (erasing && found.node && found.node->node_height()) {
+                for (auto child = node->child_at(found.idx);; child = node->child_at(node->node_usage())) {
+                    own_sibling(node, child);
+                    node = own(child);
+                    if (node->node_height() == 0) break;
+                }
+            }
+            if (retired.size() == before) return false;
+            invalidate_model(); // its leaves may have been replaced
+            return true;
+        }
+
+        // free the replaced node versions that no live snapshot can reach any more
+        void reclaim() {
+            auto oldest = ctx->oldest_snapshot.load(std::memory_order_acquire);
+            size_t done = 0;
+            for (; done < retired.size() && retired[done].second <= oldest; ++done) {
+                release(retired[done].first);
+            }
+            retired.erase(retired.begin(), retired.begin() + done);
+        }
+
+        // after a write: show optimistic readers the new root, and now and then free what they can't reach
+        void publish() {
+            if (!ctx->deferred) return;
+            ctx->top.store(root, std::memory_order_release);
+            if (ctx->garbage.size() < 64) return;
+            ctx->quiesce();
+            for (auto node: ctx->garbage) delete node;
+            ctx->garbage.clear();
+        }
+
+        // insert starting from a node whose key range holds `key`
+        std::optional<V> insert_at(Node *start, const K &key, const V &value) {
+            if (unshare(key, false)) start = root;
+            auto res = start->insert(key, value, &root);
+            if (!res) {
+                _size++;
+                invalidate_model();
+                if (bloom) {
+                    if (_size > bloom->capacity) rebuild_bloom();
+                    else bloom->add(key);
+                }
+            }
+            sync_radix();
+            if (!retired.empty()) reclaim();
+            publish();
+            return res;
+        }
+
+        // the subtrees `depth` levels below `node` in key order, and the separator entries between them
+        void collect_subtrees(Node *node, unsigned depth, std::vector<Node *> &parts,
+                              std::vector<typename Node::iterator> &seps) {
+            if (depth == 0) {
+                parts.push_back(node);
+                return;
+            }
+            for (uint16_t i = 0; i <= node->node_usage(); ++i) {
+                collect_subtrees(node->child_at(i), depth - 1, parts, seps);
+                if (i < node->node_usage()) {
+                    seps.push_back(typename Node::iterator{.idx = i, .node = node});
+                }
+            }
+        }
+
+        /*
+         * Lower a subtree that grew above `height` while it was detached: its entries become separators of its
+         * parent around its children (splitting the parent as needed), then any child still too tall is
+         * lowered the same way.
+         */
+        void flatten(Node *grown, uint8_t height) {
+            auto usage = grown->node_usage();
+            std::vector<Node *> kids(usage + 1);
+            for (uint16_t i = 0; i <= usage; ++i) {
+                kids[i] = grown->child_at(i);
+            }
+            auto parent = grown->node_parent();
+            auto position = grown->node_idx();
+            for (uint16_t i = 0; i < usage; ++i) {
+                if (i > 0) {
+                    parent = kids[i]->node_parent();
+                    position = kids[i]->node_idx();
+                }
+                parent->graft(kids[i], kids[i + 1], static_cast<Inner *>(grown)->slots.release(i), std::move(grown->value_at(i)),
+                              position, &root);
+            }
+            release(grown); // the children are owned by the parent now
+            for (auto kid: kids) {
+                if (kid->node_height() > height) flatten(kid, height);
+            }
+        }
+
+        /*
+         * Merge the operations ops[from, to), all strictly inside the key range of `leaf`, with its entries and
+         * write the result back: into the leaf alone, or cut into leaves of B - 1 to 2B - 2 entries whose
+         * separators are grafted into the parent left to right. Returns the number of entries erased, or
+         * nothing (and changes nothing) if the leaf would be left short by more than one entry.
+         */
+        std::optional<size_t> merge_leaf(Leaf *leaf, size_t from, size_t to,
+                                         std::vector<std::pair<K, std::optional<V>>> &ops) {
+            // the keys of the leaf, read in one pass
+            std::vector<K> held;
+            held.reserve(leaf->usage);
+            leaf->slots.each(leaf->usage, [&](uint16_t, const K &key) { held.push_back(key); });
+            size_t inserted = 0, erased = 0, total = leaf->usage;
+            for (size_t a = 0, j = from; j < to; ++j) {
+                auto &key = ops[j].first;
+                while (a < leaf->usage && ctx->comp(held[a], key)) a++;
+                bool present = a < leaf->usage && !ctx->comp(key, held[a]);
+                if (!present && ops[j].second) inserted++, total++;
+                if (present && !ops[j].second) erased++, total--;
+            }
+            if (leaf->parent && total + 2 < B) return std::nullopt;
+            std::vector<std::pair<K, V>> merged;
+            merged.reserve(total);
+            for (size_t a = 0, j = from; a < leaf->usage || j < to;) {
+                if (j == to || (a < leaf->usage && ctx->comp(held[a], ops[j].first))) {
+                    merged.emplace_back(std::move(held[a]), std::move(leaf->value_at(a)));
+                    a++;
+                    continue;
+                }
+                auto &[key, value] = ops[j++];
+                bool present = a < leaf->usage && !ctx->comp(key, held[a]);
+                if (present) a++;
+                if (value) {
+                    if (bloom && !present) bloom->add(key);
+                    merged.emplace_back(std::move(key), std::move(*value));
+                } else if (present && hashed) {
+                    hashed->remove(key);
+                }
+            }
+            if (inserted || erased) invalidate_model();
+            _size = _size + inserted - erased;
+            bloom_erased += erased;
+            // as many leaves as keep each at most 2B - 2 entries, the entries between them going up
+            size_t count = (total + 1 + 2 * B - 2) / (2 * B - 1);
+            auto part = [&](size_t q) { return (total - (count - 1)) / count + (q < (total - (count - 1)) % count); };
+            auto fill = [&](Leaf *target, size_t first, size_t n) {
+                target->slots.fill(n, [&, at = first]() mutable { return std::move(merged[at++].first); });
+                for (size_t e = 0; e < n; ++e) {
+                    new(target->values + e) V(std::move(merged[first + e].second));
+                }
+                target->usage = n;
+                target->touch();
+            };
+            // the leaves to the right are built before the leaf is cut down, and all of them stay open to
+            // optimistic readers until the last is grafted: until then each one reachable is missing the keys
+            // of those still to come
+            std::vector<Leaf *> right(count - 1);
+            size_t at = part(0);
+            for (size_t q = 1; q < count; ++q) {
+                right[q - 1] = new Leaf(*ctx);
+                fill(right[q - 1], at + 1, part(q));
+                right[q - 1]->write_begin();
+                at += 1 + part(q);
+            }
+            if (count > 1) leaf->restructured(leaf, leaf);
+            leaf->write_begin();
+            leaf->drop_entries();
+            fill(leaf, 0, part(0));
+            Node *left = leaf;
+            at = part(0);
+            for (size_t q = 1; q < count; ++q) {
+                auto &[key, value] = merged[at];
+                at += 1 + part(q);
+                if (auto parent = left->node_parent()) {
+                    parent->graft(left, right[q - 1], std::move(key), std::move(value), left->node_idx(), &root);
+                } else {
+                    root = Leaf::singleton(left, right[q - 1], std::move(key), std::move(value), *ctx);
+                }
+                left = right[q - 1];
+            }
+            // a new root must be visible before the leaf opens again; not through publish, whose quiesce would
+            // wait for readers spinning on the leaf
+            if (ctx->deferred) ctx->top.store(root, std::memory_order_release);
+            leaf->write_end();
+            for (auto r: right) r->write_end();
+            if (count == 1 && leaf->parent) leaf->fix_underflow(&root);
+            if (bloom && _size > bloom->capacity) rebuild_bloom();
+            return erased;
+        }
+
+    public:
+
+        BTree(Compare comp = Compare()) : ctx(std::make_unique<Context>(comp)) {}
+
+        BTree(BTree &&that) : _size(that._size), root(that.root), ctx(std::move(that.ctx)),
+                              radix(std::move(that.radix)), radix_shift(that.radix_shift),
+                              radix_reroots(that.radix_reroots), segments(std::move(that.segments)),
+                              fences(std::move(that.fences)), leaves(std::move(that.leaves)),
+                              model_error(that.model_error), hashed(std::move(that.hashed)),
+                              bloom(std::move(that.bloom)), bloom_bits(that.bloom_bits),
+                              bloom_erased(that.bloom_erased), retired(std::move(that.retired)),
+                              checkpointed(that.checkpointed), generation(that.generation),
+                              lineage(that.lineage) {
+            that._size = 0;
+            that.root = nullptr;
+            that.ctx = std::make_unique<Context>(ctx->comp);
+        }
+
+        BTree(const BTree &that) : ctx(std::make_unique<Context>(that.ctx->comp)) {
+            _size = that._size;
+            if (that.root == nullptr) {
+                root = nullptr;
+                return;
+            } else {
+                root = that.root->same_type(*ctx);
+                that.root->traversal_copy(root, *ctx);
+            }
+        }
+
+        using iterator = typename Node::iterator;
+#ifdef DEBUG_MODE
+
+        void display() {
+            if (root) root->display(0);
+        };
+#endif
+
+        std::optional<V> insert(const K &key, const V &value) {
+            if (root == nullptr) {
+                auto node = new __btree_impl::BTreeNode<K, V, false, Search, Compare, B>(*ctx);
+                node->slots.place(0, 0, key);
+                node->usage = 1;
+                new(node->__values) V(value);
+                node->touch();
+                root = node;
+                ctx->reroots++;
+                _size++;
+                if (bloom) bloom->add(key);
+                sync_radix();
+                publish();
+                return std::nullopt;
+            }
+            return insert_at(root, key, value);
+        }
+
+        /*
+         * Insert a batch with several threads. The batch is sorted (the last entry of a key wins) and split by
+         * the separators of the top levels into disjoint subtrees, at least four per thread where the tree is
+         * tall enough. Each subtree is detached and filled by one thread as a tree of its own; afterwards the
+         * subtrees are put back and those that grew taller are lowered into their parents, splitting upwards
+         * as an ordinary insert would. Keys equal to a separator above the subtrees only replace its value.
+         * Small trees, trees keeping a radix directory, hash index or Bloom filter (all updated on every
+         * write), trees with live snapshots and trees read optimistically are filled serially. Returns the number of new keys.
+         */
+        size_t insert_batch_parallel(std::vector<std::pair<K, V>> batch, unsigned threads) {
+            std::stable_sort(batch.begin(), batch.end(),
+                             [&](auto &a, auto &b) { return ctx->comp(a.first, b.first); });
+            size_t last = 0;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (i + 1 < batch.size() && !ctx->comp(batch[i].first, batch[i + 1].first)) continue;
+                if (last != i) batch[last] = std::move(batch[i]);
+                last++;
+            }
+            batch.resize(last);
+            size_t before = _size;
+            if (threads <= 1 || root == nullptr || root->node_height() == 0 || !radix.empty() || hashed || bloom ||
+                ctx->frozen_below.load() || ctx->deferred) {
+                for (auto &[key, value]: batch) insert(key, value);
+                return _size - before;
+            }
+            std::vector<Node *> parts;
+            std::vector<typename Node::iterator> seps;
+            unsigned depth = 0;
+            while (depth < root->node_height() && parts.size() < 4 * threads) {
+                parts.clear();
+                seps.clear();
+                collect_subtrees(root, ++depth, parts, seps);
+            }
+            uint8_t height = root->node_height() - depth;
+            // [first[j], first[j + 1]) of the batch goes to parts[j]
+            std::vector<size_t> first(parts.size() + 1, batch.size());
+            std::vector<bool> replaced(batch.size());
+            size_t j = 0;
+            first[0] = 0;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                while (j < seps.size() && ctx->comp(seps[j].node->key_at(seps[j].idx), batch[i].first)) {
+                    first[++j] = i;
+                }
+                if (j < seps.size() && !ctx->comp(batch[i].first, seps[j].node->key_at(seps[j].idx))) {
+                    seps[j].node->value_at(seps[j].idx) = std::move(batch[i].second);
+                    seps[j].node->dirty = true;
+                    seps[j].node->mark_ancestors();
+                    replaced[i] = true;
+                }
+            }
+            while (j < seps.size()) first[++j] = batch.size();
+            std::vector<Node *> parents(parts.size());
+            std::vector<uint16_t> slots(parts.size());
+            for (size_t p = 0; p < parts.size(); ++p) {
+                parents[p] = parts[p]->node_parent();
+                slots[p] = parts[p]->node_idx();
+                parts[p]->node_parent() = nullptr;
+            }
+            // contiguous runs of subtrees with about the same number of keys per thread
+            std::vector<size_t> added(threads);
+            std::vector<std::thread> workers;
+            size_t p = 0;
+            for (unsigned t = 0; t < threads && p < parts.size(); ++t) {
+                auto begin = p;
+                auto goal = batch.size() * (t + 1) / threads;
+                while (p < parts.size() && (first[p + 1] <= goal || p == begin)) p++;
+                if (t + 1 == threads) p = parts.size();
+                workers.emplace_back([&, t, begin, end = p] {
+                    for (auto q = begin; q < end; ++q) {
+                        for (auto i = first[q]; i < first[q + 1]; ++i) {
+                            if (!replaced[i] && !parts[q]->insert(batch[i].first, batch[i].second, &parts[q])) {
+                                added[t]++;
+                            }
+                        }
+                    }
+                });
+            }
+            for (auto &worker: workers) worker.join();
+            for (size_t q = 0; q < parts.size(); ++q) {
+                parents[q]->child_at(slots[q]) = parts[q];
+                parts[q]->node_parent() = parents[q];
+                parts[q]->node_idx() = slots[q];
+                if (parts[q]->dirty || parts[q]->dirty_below) parts[q]->mark_ancestors();
+            }
+            for (auto part: parts) {
+                if (part->node_height() > height) flatten(part, height);
+            }
+            for (auto n: added) _size += n;
+            if (_size != before) invalidate_model();
+            return _size - before;
+        }
+
+        /*
+         * Radix directory over the top levels of the tree (integral keys ordered by std::less only): a flat
+         * table indexed by the high `bits` bits of a key points at the deepest internal node whose key range
+         * covers all keys sharing those bits, so lookups start below the upper internal levels instead of at
+         * the root. Splits, merges and borrows of internal nodes patch the slots of the key range they touched
+         * at the end of the write; leaves are never referenced, so their (frequent) splits cost nothing.
+         */
+        void enable_radix(unsigned bits) {
+            static_assert(ordered_integers, "the radix directory needs integral keys ordered by std::less");
+            bits = std::min<unsigned>({bits, 8 * sizeof(K), 24});
+            radix_shift = 8 * sizeof(K) - bits;
+            radix.assign(size_t(1) << bits, nullptr);
+            ctx->watch_height = 1;
+            rebuild_radix();
+        }
+
+        void disable_radix() {
+            radix.clear();
+            radix.shrink_to_fit();
+            ctx->watch_height = UINT8_MAX;
+        }
+
+        /*
+         * Bloom filter in front of the tree, so that `member` and `find` answer most absent keys without
+         * descending at all (about 1% false positives at the default 10 bits per key). New keys are added on
+         * insert; the filter is rebuilt from the tree when it outgrows its capacity or when the erased keys it
+         * still remembers outnumber the live ones, which keeps both costs amortized O(1) per write. Needs
+         * std::hash<K> consistent with `Compare`.
+         */
+        void enable_bloom_filter(size_t bits_per_key = 10) {
+            bloom_bits = bits_per_key;
+            rebuild_bloom();
+        }
+
+        void disable_bloom_filter() {
+            bloom.reset();
+        }
+
+        /*
+         * Hash index for point lookups: every key is mapped to the node holding it, so `member` and `find`
+         * cost a hash probe (plus a search inside one node) instead of a descent, while ordered scans still
+         * walk the tree. Splits, merges and borrows re-register the keys they move; inserts and erases update
+         * their own key. Needs std::hash<K> consistent with `Compare`.
+         */
+        void enable_hash_index() {
+            hashed = std::make_unique<__btree_impl::hash_index<K, Node, Compare>>(ctx->comp);
+            hashed->reserve(_size);
+            for (auto iter = begin(); iter != end(); iter = iter.node->successor(iter.idx)) {
+                hashed->assign(iter.node->key_at(iter.idx), iter.node);
+            }
+            ctx->index = hashed.get();
+        }
+
+        void disable_hash_index() {
+            ctx->index = nullptr;
+            hashed.reset();
+        }
+
+        /*
+         * Learned index for read-mostly trees with arithmetic keys ordered by std::less: the model is fit over the
+         * leaves, whose first keys are ranked in order, and the key -> leaf function is approximated by
+         * piecewise-linear segments, each predicting the leaf of its fences to within `error` leaves. A lookup
+         * evaluates one segment, searches a window of about 2 * error fences and then the leaf, instead of
+         * descending the tree. Costs one key and one pointer per leaf. Inserting a new key or erasing one drops
+         * the model (lookups fall back to the tree) until it is built again; replacing a value keeps it.
+         */
+        void build_learned_index(size_t error = 4) {
+            static_assert(ordered_numbers, "the learned index needs arithmetic keys ordered by std::less");
+            invalidate_model();
+            if (_size == 0) return;
+            model_error = error;
+            auto collect = [&](auto &self, Node *node) -> void {
+                if (node->node_height() == 0) {
+                    fences.push_back(node->key_at(0));
+                    leaves.push_back(node);
+                    return;
+                }
+                for (uint16_t i = 0; i <= node->node_usage(); ++i) {
+                    self(self, node->child_at(i));
+                }
+            };
+            collect(collect, root);
+            // greedy shrinking cone: extend the segment while some slope keeps every point within the error
+            auto e = double(error);
+            size_t start = 0;
+            double lo = -INFINITY, hi = INFINITY;
+            auto close = [&](size_t next) {
+                auto slope = std::isinf(lo) ? 0.0 : std::isinf(hi) ? lo : (lo + hi) / 2;
+                segments.push_back(Segment{fences[start], slope, start});
+                start = next;
+                lo = -INFINITY;
+                hi = INFINITY;
+            };
+            for (size_t i = 1; i < fences.size(); ++i) {
+                auto dx = double(fences[i]) - double(fences[start]);
+                auto dy = double(i - start);
+                if (dx <= 0) {
+                    // keys too close to tell apart in a double all predict the segment start
+                    if (dy > e) close(i);
+                    continue;
+                }
+                auto new_lo = std::max(lo, (dy - e) / dx);
+                auto new_hi = std::min(hi, (dy + e) / dx);
+                if (new_lo > new_hi) {
+                    close(i);
+                } else {
+                    lo = new_lo;
+                    hi = new_hi;
+                }
+            }
+            close(fences.size());
+        }
+
+        void drop_learned_index() {
+            invalidate_model();
+            segments.shrink_to_fit();
+            fences.shrink_to_fit();
+            leaves.shrink_to_fit();
+        }
+
+        /*
+         * Binary image of the entries in key order, written in one pass: a header with a magic, the number of
+         * entries and its CRC-32, then chunks of about 64 KiB of entries encoded with `codec`, each behind its
+         * length and CRC-32. `load` builds the tree bottom-up while reading it one chunk at a time, in O(n) like
+         * `from_sorted`, and returns nothing if the image is cut short, corrupt or out of order. Saving returns
+         * false on a write error; a successful save is also the base that the next `checkpoint` is a delta on.
+         */
+        bool save(std::ostream &out) {
+            return save_to(writing(out));
+        }
 
-                left->usage += right->usage;
-                right->usage = 0;
-                delete right;
+        bool save(int fd) {
+            return save_to(writing(fd));
+        }
 
-                for (auto i = left->parent_idx; i <= parent->usage; ++i) {
-                    parent->children[i]->node_idx() = i;
-                }
+        static std::optional<BTree> load(std::istream &in, Compare comp = Compare()) {
+            return load_from(reading(in), comp);
+        }
 
-                if (parent->usage == 0) /* only possible at root or B == 2 */ {
-                    ASSERT(parent == *root);
-                    parent->usage = 0;
-                    delete (parent);
-                    left->parent = nullptr;
-                    *root = left;
-                    return;
-                }
+        static std::optional<BTree> load(int fd, Compare comp = Compare()) {
+            return load_from(reading(fd), comp);
+        }
 
-                parent->fix_underflow(root);
+        /*
+         * Incremental checkpoints. Every in-place change marks its node dirty and flags the way up to the root,
+         * so `checkpoint` visits only changed nodes and their ancestors: it writes the entries of changed nodes,
+         * and every unchanged subtree as just its first and last key, to be copied from the state of the last
+         * `save`, `load` or `checkpoint`, which the delta applies to. A delta costs about B entries per changed
+         * node instead of the whole tree. Loading a base image followed by its deltas in order replays each one
+         * as a bulk build and refuses a delta that is damaged or not on the tree before it: a delta names what it
+         * follows by its place in the chain and the CRC-32 of the whole image or delta written there. Writes
+         * through iterators (`(*iter).second = ...`) are not tracked and must be made with `insert`.
+         */
+        bool checkpoint(std::ostream &out) {
+            return checkpoint_to(writing(out));
+        }
+
+        bool checkpoint(int fd) {
+            return checkpoint_to(writing(fd));
+        }
+
+        static std::optional<BTree> load(std::istream &base, const std::vector<std::istream *> &deltas,
+                                         Compare comp = Compare()) {
+            auto tree = load(base, comp);
+            for (auto delta: deltas) {
+                if (!tree) break;
+                auto next = tree->apply_delta(reading(*delta));
+                tree.reset();
+                if (next) tree.emplace(std::move(*next));
             }
+            return tree;
+        }
 
-            void fix_underflow(NodePtr *root) override {
-                if (usage >= B - 1 || !parent) return;
-                if (parent_idx) {
-                    auto target = parent->child_at(parent_idx - 1);
-                    if (target->node_usage() > B - 1) {
-                        borrow_left(target);
-                    } else {
-                        merge(target, this, root);
-                    }
+        static std::optional<BTree> load(int base, const std::vector<int> &deltas, Compare comp = Compare()) {
+            auto tree = load(base, comp);
+            for (auto delta: deltas) {
+                if (!tree) break;
+                auto next = tree->apply_delta(reading(delta));
+                tree.reset();
+                if (next) tree.emplace(std::move(*next));
+            }
+            return tree;
+        }
+
+        /*
+         * Build a tree from entries sorted by strictly increasing key (pairs with `first` and `second`), in
+         * O(n) and with every node packed as full as the shape allows, instead of n inserts.
+         */
+        template<typename Iter>
+        static BTree from_sorted(Iter first, Iter last, Compare comp = Compare()) {
+            BTree tree(comp);
+            tree.assign_sorted(std::distance(first, last), [&] { return std::optional<std::pair<K, V>>(*first++); });
+            return tree;
+        }
+
+        /*
+         * Set operations by key, returning a new bulk-built tree; an entry present in both trees keeps the value
+         * of this one. Both trees are walked in lockstep (O(n + m)), except that when one side of an
+         * intersection or difference is much smaller, its keys are probed in the other tree instead.
+         */
+        BTree merge_union(BTree &that) {
+            std::vector<iterator> picked;
+            picked.reserve(_size + that._size);
+            auto i = begin(), j = that.begin();
+            while (i != end() && j != that.end()) {
+                if (less(j, i)) {
+                    picked.push_back(j);
+                    ++j;
                 } else {
-                    auto target = parent->child_at(parent_idx + 1);
-                    if (target->node_usage() > B - 1) {
-                        borrow_right(target);
-                    } else {
-                        merge(this, target, root);
-                    }
+                    if (!less(i, j)) ++j;
+                    picked.push_back(i);
+                    ++i;
                 }
             }
+            for (; i != end(); ++i) picked.push_back(i);
+            for (; j != that.end(); ++j) picked.push_back(j);
+            return collect(picked);
+        }
 
-#ifdef DEBUG_MODE
-
-            void display(size_t ident) override {
-                std::string idents(ident ? ident - 1 : 0, '-');
-                if (ident) idents.push_back('>');
-                if (ident) idents.push_back(' ');
-                {
-                    unsigned i = 0;
-                    for (; i < usage; ++i) {
-                        std::cout << " " << std::setw(4) << keys[i];
-                    }
-                    for (; i < 2 * B - 2; ++i) {
-                        std::cout << " " << std::setw(4) << "_";
-                    }
+        BTree intersection(BTree &that) {
+            std::vector<iterator> picked;
+            if (skewed(that._size, _size)) {
+                for (auto j = that.begin(); j != that.end(); ++j) {
+                    auto i = find(j.node->key_at(j.idx));
+                    if (i != end()) picked.push_back(i);
                 }
-                std::cout << std::endl;
-                if constexpr (IsInternal) {
-                    for (auto i = 0; i <= usage; ++i) {
-                        children[i]->display(ident + 4);;
-                    }
+                return collect(picked);
+            }
+            if (skewed(_size, that._size)) {
+                for (auto i = begin(); i != end(); ++i) {
+                    if (that.member(i.node->key_at(i.idx))) picked.push_back(i);
                 }
+                return collect(picked);
             }
-
-#endif
-
-            typename Node::iterator min() override {
-                if constexpr(IsInternal) {
-                    return children[0]->min();
+            auto i = begin(), j = that.begin();
+            while (i != end() && j != that.end()) {
+                if (less(i, j)) {
+                    ++i;
+                } else if (less(j, i)) {
+                    ++j;
                 } else {
-                    return typename Node::iterator{
-                            .idx = 0,
-                            .node = this
-                    };
+                    picked.push_back(i);
+                    ++i;
+                    ++j;
                 }
             }
+            return collect(picked);
+        }
 
-            typename Node::iterator max() override {
-                if constexpr(IsInternal) {
-                    return children[usage]->max();
-                } else {
-                    return typename Node::iterator{
-                            .idx = uint16_t(usage - 1u),
-                            .node = this
-                    };
+        BTree difference(BTree &that) {
+            std::vector<iterator> picked;
+            if (skewed(_size, that._size)) {
+                for (auto i = begin(); i != end(); ++i) {
+                    if (!that.member(i.node->key_at(i.idx))) picked.push_back(i);
                 }
+                return collect(picked);
             }
-
-            NodePtr &child_at(size_t i) override {
-                if constexpr (IsInternal) {
-                    return children[i];
+            picked.reserve(_size);
+            auto i = begin(), j = that.begin();
+            while (i != end()) {
+                if (!(j != that.end()) || less(i, j)) {
+                    picked.push_back(i);
+                    ++i;
                 } else {
-                    std::abort();
+                    if (!less(j, i)) ++i;
+                    ++j;
                 }
             }
+            return collect(picked);
+        }
+
+        bool empty() {
+            return _size == 0;
+        }
 
-            inline K &key_at(size_t i) override {
-                return keys[i];
+        bool member(const K &key) {
+            if (ctx->deferred) return optimistic(key, [](Node *node, uint16_t) { return node != nullptr; });
+            if (bloom && !bloom->may_contain(key)) return false;
+            if (hashed) return hashed->get(key) != nullptr;
+            if constexpr (ordered_numbers) {
+                if (!segments.empty()) return model_find(key) != end();
             }
+            return root && lookup_start(key)->member(key);
+        }
 
-            inline V &value_at(size_t i) override {
-                return values[i];
+        iterator find(const K &key) {
+            if (bloom && !bloom->may_contain(key)) return end();
+            if (hashed) {
+                auto node = hashed->get(key);
+                return node ? node->find(key) : end();
+            }
+            if constexpr (ordered_numbers) {
+                if (!segments.empty()) return model_find(key);
             }
+            if (root == nullptr) return end();
+            return lookup_start(key)->find(key);
+        }
 
-            typename Node::iterator predecessor(uint16_t idx) override {
-                if constexpr (IsInternal) {
-                    return children[idx]->max();
-                } else {
-                    if (idx)
-                        return typename Node::iterator{
-                                .idx = uint16_t(idx - 1u),
-                                .node = this
-                        };
-                    else {
-                        NodePtr node = this;
-                        while (node->node_parent() && node->node_idx() == 0) {
-                            node = node->node_parent();
-                        }
-                        if (node->node_parent()) {
-                            return typename Node::iterator{
-                                    .idx = uint16_t(node->node_idx() - 1u),
-                                    .node = node->node_parent()
-                            };
-                        } else {
-                            return typename Node::iterator{
-                                    .idx = 0,
-                                    .node = nullptr
-                            };
-                        }
-                    }
+        iterator lower_bound(const K &key) {
+            if (root == nullptr) return end();
+            return root->lower_bound(key);
+        }
+
+        /*
+         * Batched find for keys in ascending order: writes find(key) for every key to `out`. Consecutive keys
+         * reuse the position of the previous one and climb only as far as the next key needs (as
+         * `cursor::seek` does) instead of descending from the root each time.
+         */
+        template<typename InputIt, typename OutputIt>
+        OutputIt find_sorted(InputIt first, InputIt last, OutputIt out) {
+            if (first == last) return out;
+            auto at = lower_bound(*first);
+            for (; first != last; ++first) {
+                const K &key = *first;
+                if (at.node && at.node->precedes(at.idx, key)) {
+                    at = at.node->seek(key);
                 }
+                *out++ = at.node && !at.node->follows(at.idx, key) ? at : end();
             }
+            return out;
+        }
 
-            typename Node::iterator successor(uint16_t idx) override {
-                if constexpr (IsInternal) {
-                    return children[idx + 1]->min();
-                } else {
-                    if (idx < usage - 1)
-                        return typename Node::iterator{
-                                .idx = uint16_t(idx + 1u),
-                                .node = this
-                        };
-                    else {
-                        NodePtr node = this;
-                        while (node->node_parent() && node->node_idx() == node->node_parent()->node_usage()) {
-                            node = node->node_parent();
-                        }
-                        if (node->node_parent()) {
-                            return typename Node::iterator{
-                                    .idx = node->node_idx(),
-                                    .node = node->node_parent()
-                            };
-                        } else {
-                            return typename Node::iterator{
-                                    .idx = 0,
-                                    .node = nullptr
-                            };
-                        }
+        /*
+         * find() for every key of query[0, n) into out[0, n), descending for a group of keys at once: each
+         * round moves every unfinished key of the group one level down and prefetches the child it goes to,
+         * so the cache misses of the group overlap instead of being paid one after another.
+         */
+        void find_interleaved(const K *query, size_t n, iterator *out) {
+            constexpr size_t Group = 16;
+            Node *at[Group];
+            for (size_t base = 0; base < n; base += Group) {
+                auto count = std::min(Group, n - base);
+                for (size_t i = 0; i < count; ++i) {
+                    at[i] = root;
+                    out[base + i] = end();
+                }
+                if (root == nullptr) continue;
+                for (bool busy = true; busy;) {
+                    busy = false;
+                    for (size_t i = 0; i < count; ++i) {
+                        if (at[i] == nullptr) continue;
+                        at[i] = at[i]->descend(query[base + i], out[base + i]);
+                        busy |= at[i] != nullptr;
                     }
                 }
             }
+        }
 
-            ~BTreeNode() override {
-#ifdef DEBUG_MODE
-                alive_node--;
-#endif
-                std::destroy(keys, keys + usage);
-                std::destroy(values, values + usage);
-                if constexpr(IsInternal) {
-                    if (usage)
-                        for (auto i = 0; i <= usage; ++i) {
-                            delete children[i];
-                        }
+        /*
+         * find() for a large batch, split into one contiguous slice per thread of `pool`, each looked up with
+         * `find_interleaved`. Only reads the tree, so it is safe as long as no writer runs at the same time.
+         */
+        void find_batch_parallel(const std::vector<K> &query, std::vector<iterator> &out, WorkerPool &pool) {
+            out.resize(query.size());
+            auto parts = pool.size();
+            pool.run([&](size_t part) {
+                auto first = query.size() * part / parts;
+                auto last = query.size() * (part + 1) / parts;
+                find_interleaved(query.data() + first, last - first, out.data() + first);
+            });
+        }
+
+        /*
+         * Optimistic descent from the published root. The child's counter is read before the parent is checked
+         * again, so the child cannot change between being picked and being entered unnoticed; `read` gets the
+         * node and slot holding the key (or a null node) and its result only counts if the node is unchanged
+         * afterwards. Any change met on the way starts the descent over from the root.
+         */
+        template<typename F>
+        auto optimistic(const K &key, F read) {
+            auto &indicator = ctx->indicators[ctx->phase.load()];
+            indicator.readers.fetch_add(1);
+            struct Departure {
+                typename Context::Indicator &indicator;
+
+                ~Departure() { indicator.readers.fetch_sub(1); }
+            } departure{indicator};
+            while (true) {
+                auto node = ctx->top.load(std::memory_order_acquire);
+                if (!node) return read(nullptr, 0);
+                auto seen = node->seq.load(std::memory_order_acquire);
+                while (!(seen & 1u)) {
+                    uint16_t idx;
+                    bool found;
+                    auto child = node->probe(key, idx, found);
+                    auto result = read(found ? node : nullptr, idx);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (node->seq.load(std::memory_order_relaxed) != seen) break;
+                    if (!child) return result;
+                    auto next = child->seq.load(std::memory_order_acquire);
+                    if (node->seq.load(std::memory_order_relaxed) != seen) break;
+                    node = child;
+                    seen = next;
                 }
+                std::this_thread::yield();
             }
+        }
 
-            std::pair<K, V> erase(uint16_t index, NodePtr *root) override {
-                if constexpr (IsInternal) {
-                    auto pred = children[index]->max();
-                    std::swap(keys[index], pred.node->key_at(pred.idx));
-                    std::swap(values[index], pred.node->value_at(pred.idx));
-                    return pred.node->erase(pred.idx, root);
-                } else {
-                    std::pair<K, V> result(std::move(keys[index]), std::move(values[index]));
-                    std::destroy_at(keys + index);
-                    std::destroy_at(values + index);
-                    uninitialized_move_forward(keys + index + 1, keys + usage);
-                    uninitialized_move_forward(values + index + 1, values + usage);
-                    usage--;
-                    fix_underflow(root);
-                    return result;
-                }
+        /*
+         * Single writer, many readers: once enabled, `lookup` and `member` may run on any number of threads
+         * while one thread writes; `member` then bypasses the accelerators (bloom filter, hash index, learned
+         * model, radix table), which belong to the writer. Everything else, `find` and every other call handing
+         * out iterators included, stays on the writer's thread: an iterator points into a node the writer may
+         * free as soon as the reader has left. Every node carries a sequence counter the writer makes odd
+         * around each change it makes in place (and leaves odd on nodes it unlinks); a lookup reads a node,
+         * reads the counter of the child it picked, checks the node's counter is unchanged and only then
+         * follows the child, starting over from the root otherwise. Unlinked nodes are freed in batches once
+         * every lookup that might still hold them has left. Keys and values are copied while the writer may be
+         * changing them, so both must be trivially copyable.
+         */
+        void enable_optimistic_reads() {
+            static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                          "optimistic reads copy keys and values racing with the writer");
+            ctx->deferred = true;
+            ctx->top.store(root, std::memory_order_release);
+        }
+
+        // with no lookup running
+        void disable_optimistic_reads() {
+            ctx->deferred = false;
+            ctx->top.store(nullptr);
+            for (auto node: ctx->garbage) delete node;
+            ctx->garbage.clear();
+        }
+
+        // the value under `key`, copied out; without optimistic reads this is `find` on the writer's thread
+        std::optional<V> lookup(const K &key) {
+            if (!ctx->deferred) {
+                auto iter = find(key);
+                if (!iter.node) return std::nullopt;
+                return iter.node->value_at(iter.idx);
             }
-        };
+            return optimistic(key, [](Node *node, uint16_t idx) -> std::optional<V> {
+                if (node) return node->value_at(idx);
+                return std::nullopt;
+            });
+        }
 
-    }
+        /*
+         * Read-only view of the tree as it was when taken. While snapshots are live, the writer copies each node
+         * a write would modify (and the path above it) instead of changing it in place, so a snapshot is a root
+         * pointer into nodes nobody writes to any more, and reading it needs no lock however long it takes.
+         * Replaced nodes are freed by later writes once no snapshot old enough to see them is left. Reads go
+         * strictly top-down, as the parent links of shared nodes follow the current version.
+         *
+         * Snapshots are taken on the writer's thread (or between writes), may be read and dropped on any
+         * thread, and must not outlive the tree. Values must not be changed through iterators while snapshots
+         * are live: use `insert`, which copies the node first.
+         */
+        class Snapshot {
+            friend BTree;
+            Context *ctx;
+            Node *root;
+            size_t version;
+            size_t _size;
+
+            Snapshot(Context *ctx, Node *root, size_t version, size_t size)
+                    : ctx(ctx), root(root), version(version), _size(size) {}
+
+            // calls `f(key, value)` in key order while it returns true; false if it stopped the walk.
+            // Leaves are read in one pass over their slots.
+            template<typename F>
+            static bool walk(Node *node, F &f) {
+                auto usage = node->node_usage();
+                if (node->node_height() == 0) {
+                    bool going = true;
+                    static_cast<Leaf *>(node)->slots.each(usage, [&](uint16_t i, const K &key) {
+                        going = going && f(key, std::as_const(node->value_at(i)));
+                    });
+                    return going;
+                }
+                for (uint16_t i = 0; i < usage; ++i) {
+                    if (!walk(node->child_at(i), f)) return false;
+                    if (!f(node->key_at(i), std::as_const(node->value_at(i)))) return false;
+                }
+                return walk(node->child_at(usage), f);
+            }
 
-    template<typename K, typename V, bool UseBinary, size_t B, typename Compare>
-    class BTree {
+        public:
+            Snapshot(Snapshot &&that) noexcept : ctx(that.ctx), root(that.root), version(that.version),
+                                                 _size(that._size) {
+                that.ctx = nullptr;
+            }
 
-        using Node = __btree_impl::AbstractBTNode<K, V, UseBinary, B, Compare>;
-        size_t _size = 0;
-        Node *root = nullptr;
+            Snapshot &operator=(Snapshot &&that) noexcept {
+                std::swap(ctx, that.ctx);
+                std::swap(root, that.root);
+                std::swap(version, that.version);
+                std::swap(_size, that._size);
+                return *this;
+            }
 
-        Compare comp;
-    public:
+            Snapshot(const Snapshot &) = delete;
 
-        BTree(Compare comp = Compare()) : comp(comp) {}
+            ~Snapshot() {
+                if (!ctx) return;
+                std::lock_guard<std::mutex> guard(ctx->snapshot_lock);
+                auto &live = ctx->snapshots;
+                live.erase(live.find(version));
+                ctx->frozen_below = live.empty() ? 0 : *live.rbegin() + 1;
+                ctx->oldest_snapshot.store(live.empty() ? SIZE_MAX : *live.begin(), std::memory_order_release);
+            }
 
-        BTree(BTree &&that) noexcept(Compare(std::move(comp))) {
-            root = that.root;
-            _size = that._size;
-            comp = std::move(that.comp);
-        }
+            std::optional<V> get(const K &key) {
+                typename Node::iterator found{.idx = 0, .node = nullptr};
+                for (auto node = root; node; node = node->descend(key, found));
+                if (!found.node) return std::nullopt;
+                return found.node->value_at(found.idx);
+            }
 
-        BTree(const BTree &that) {
-            comp = that.comp;
-            _size = that._size;
-            if (that.root == nullptr) {
-                root = nullptr;
-                return;
-            } else {
-                root = that.root->same_type(comp);
-                that.root->traversal_copy(root, comp);
+            bool member(const K &key) {
+                return get(key).has_value();
             }
-        }
 
-        using iterator = typename Node::iterator;
-#ifdef DEBUG_MODE
+            // calls `f(key, value)` for every entry in key order
+            template<typename F>
+            void for_each(F f) {
+                auto all = [&](auto &&key, const V &value) {
+                    f(key, value);
+                    return true;
+                };
+                if (root) walk(root, all);
+            }
 
-        void display() {
-            if (root) root->display(0);
+            size_t size() {
+                return _size;
+            }
         };
-#endif
 
-        std::optional<V> insert(const K &key, const V &value) {
-            if (root == nullptr) {
-                auto node = new __btree_impl::BTreeNode<K, V, false, UseBinary, Compare, B>(comp);
-                node->usage = 1;
-                new(node->__keys) K(key);
-                new(node->__values) V(value);
-                root = node;
-                _size++;
-                return std::nullopt;
-            }
-            auto res = root->insert(key, value, &root);
-            if (!res) _size++;
-            return res;
+        Snapshot snapshot() {
+            std::lock_guard<std::mutex> guard(ctx->snapshot_lock);
+            auto version = ctx->version++;
+            ctx->snapshots.insert(version);
+            ctx->frozen_below = version + 1;
+            ctx->oldest_snapshot = *ctx->snapshots.begin();
+            return Snapshot(ctx.get(), root, version, _size);
         }
 
-        bool empty() {
-            return _size == 0;
+        /*
+         * Save the tree as it is now to `path` (as `save` would) on a background thread, from a snapshot, so
+         * that writes go on meanwhile: the ones that reach nodes the snapshot still shares copy them instead of
+         * changing them in place. The image goes to a file next to `path` that is synced and renamed over it,
+         * and the rename is synced too, so `path` holds a whole image before and after. The future holds false
+         * if that failed; a write error ends the walk over the snapshot at once. Unlike `save` this leaves the
+         * base of `checkpoint` alone. Writes must stay on this thread, and the tree must not be destroyed
+         * before the future is ready; the future itself may outlive it.
+         */
+        [[nodiscard]] std::future<bool> checkpoint_async(const std::string &path) {
+            return std::async(std::launch::async, [taken = snapshot(), path]() mutable {
+                auto next = path + ".tmp";
+                bool ok;
+                int fd;
+                {
+                    // the captured snapshot would live as long as the future; this one is gone once the image
+                    // is written, and with it the copying of the nodes it shares
+                    auto shot = std::move(taken);
+                    fd = ::open(next.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                    if (fd < 0) return false;
+                    uint32_t written;
+                    ok = write_image(writing(fd), shot.size(), [&](auto &put) {
+                        return !shot.root || Snapshot::walk(shot.root, put);
+                    }, written);
+                }
+                ok = ok && ::fdatasync(fd) == 0;
+                ok = ::close(fd) == 0 && ok;
+                if (!ok || ::rename(next.c_str(), path.c_str()) != 0) {
+                    ::unlink(next.c_str());
+                    return false;
+                }
+                return __btree_impl::sync_parent(path);
+            });
         }
 
-        bool member(const K &key) {
-            return root && root->member(key);
+        /*
+         * Forward cursor for merge-style algorithms: `seek` moves to the first entry not below a key by
+         * climbing from the current position only as far as needed (a galloping search over the tree), so
+         * skipping d entries costs O(log d) instead of O(log n) or O(d).
+         */
+        struct cursor {
+            BTree *tree;
+            iterator at;
+
+            inline bool at_end() {
+                return at.node == nullptr;
+            }
+
+            inline typename Node::KeyRef key() {
+                return at.node->key_at(at.idx);
+            }
+
+            inline V &value() {
+                return at.node->value_at(at.idx);
+            }
+
+            inline bool less(const K &a, const K &b) {
+                return tree->ctx->comp(a, b);
+            }
+
+            inline void next() {
+                ++at;
+            }
+
+            void seek(const K &target) {
+                if (at.node && less(key(), target)) {
+                    at = at.node->seek(target);
+                }
+            }
+        };
+
+        cursor make_cursor() {
+            return cursor{this, begin()};
         }
 
-        const K &min_key() {
+        typename Node::KeyRef min_key() {
             auto iter = root->min();
             return iter.node->key_at(iter.idx);
         }
 
-        const K &max_key() {
+        typename Node::KeyRef max_key() {
             auto iter = root->max();
             return iter.node->key_at(iter.idx);
         }
@@ -829,11 +3810,85 @@ namespace btree {
 
         ~BTree() {
             delete root;
+            for (auto [node, version]: retired) release(node);
+        }
+
+        /*
+         * Apply a batch one leaf at a time: the operations are sorted by key (the last one on a key wins), and
+         * the run of operations falling strictly inside the key range of one leaf is merged with its entries
+         * in a single pass. The leaf is rewritten once; when the run overfills it, it is cut into as many
+         * leaves as needed, which go up into the parent as one split would, and when the run drains it, it is
+         * fixed up once. Operations on keys held by internal nodes, runs that would drain a leaf by more than
+         * one borrow can refill, and every operation while snapshots are live go through insert and erase one
+         * at a time. Every operation is in place once `apply` returns, so iterators taken afterwards see the
+         * whole batch. The batch is consumed; returns the number of entries erased.
+         */
+        size_t apply(WriteBatch<K, V> &batch) {
+            auto &ops = batch.ops;
+            std::stable_sort(ops.begin(), ops.end(), [&](auto &a, auto &b) { return ctx->comp(a.first, b.first); });
+            size_t last = 0;
+            for (size_t i = 0; i < ops.size(); ++i) {
+                if (i + 1 < ops.size() && !ctx->comp(ops[i].first, ops[i + 1].first)) continue;
+                if (last != i) ops[last] = std::move(ops[i]);
+                last++;
+            }
+            ops.resize(last);
+            // one operation on its own, through the ordinary insert and erase
+            auto one = [&](std::pair<K, std::optional<V>> &op) -> size_t {
+                if (!op.second) return erase(op.first);
+                insert(op.first, *op.second);
+                return 0;
+            };
+            size_t erased = 0;
+            for (size_t i = 0; i < ops.size();) {
+                auto &key = ops[i].first;
+                Node *node = root && !ctx->frozen_below.load(std::memory_order_acquire) ? root->locate(key) : nullptr;
+                if (!node || node->node_height() != 0) {
+                    erased += one(ops[i++]);
+                    continue;
+                }
+                auto hi = node->bounds().second;
+                auto end = i + 1;
+                while (end < ops.size() && (!hi || ctx->comp(ops[end].first, *hi))) end++;
+                auto merged = merge_leaf(static_cast<Leaf *>(node), i, end, ops);
+                if (!merged) {
+                    while (i < end) erased += one(ops[i++]);
+                    continue;
+                }
+                erased += *merged;
+                i = end;
+                // insert and erase keep the radix table in step themselves; a merged run may have split or
+                // merged internal nodes the next lookup would otherwise reach through a stale slot
+                sync_radix();
+            }
+            if (bloom && bloom_erased > _size) rebuild_bloom();
+            sync_radix();
+            publish();
+            batch.clear();
+            return erased;
+        }
+
+        size_t erase(const K &key) {
+            auto iter = find(key);
+            if (!iter.node) return 0;
+            erase(iter);
+            return 1;
         }
 
         std::pair<K, V> erase(iterator iter) {
+            if (ctx->frozen_below.load(std::memory_order_acquire)) {
+                K key = iter.node->key_at(iter.idx);
+                if (unshare(key, true)) iter = root->find(key);
+            }
             _size--;
-            return iter.node->erase(iter.idx, &root);
+            invalidate_model();
+            auto result = iter.node->erase(iter.idx, &root);
+            if (hashed) hashed->remove(result.first);
+            if (bloom && ++bloom_erased > _size) rebuild_bloom();
+            sync_radix();
+            if (!retired.empty()) reclaim();
+            publish();
+            return result;
         }
 
         std::pair<K, V> pop_min() {
@@ -850,9 +3905,28 @@ namespace btree {
             return _size;
         }
     };
+    /*
+     * Leapfrog join: calls `f(key, cursors...)` for every key present in all the trees behind the cursors,
+     * in key order, without building intermediate results. Each round seeks every cursor to the largest
+     * current key, so the work follows the smallest gaps rather than the sizes of the inputs.
+     */
+    template<typename F, typename First, typename... Rest>
+    void leapfrog_intersect(F f, First &first, Rest &... rest) {
+        while (!first.at_end() && (!rest.at_end() && ...)) {
+            auto high = first.key(); // a copy: keys of encoded leaves are rebuilt whenever they are read
+            ((high = first.less(high, rest.key()) ? rest.key() : high), ...);
+            first.seek(high);
+            (rest.seek(high), ...);
+            if (first.at_end() || (rest.at_end() || ...)) return;
+            if (!first.less(high, first.key()) && (!first.less(high, rest.key()) && ...)) {
+                f(high, first, rest...);
+                first.next();
+                (rest.next(), ...);
+            }
+        }
+    }
 }
 
-#undef keys
 #undef values
 #undef GO_DOWN
 #undef GO_DOWN_MASK
@@ -0,0 +1,225 @@
+#ifndef BTREE_CONCURRENT_HPP
+#define BTREE_CONCURRENT_HPP
+
+#include <btree.hpp>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace btree {
+
+    /*
+     * Flat-combining wrapper for a tree shared by many writers. A thread publishes its operation in a slot
+     * of its own cache line and then spins on that slot until it is answered, trying to become the combiner
+     * whenever a plain load shows the combiner flag free. The combiner collects every pending operation,
+     * sorts them by key, answers them from one ordered lookup pass, and turns the net effect on each key into
+     * a single WriteBatch for BTree::apply. The tree stays in the combiner's cache and the flag changes hands
+     * once per batch instead of once per operation. Threads hash to a home slot and move on to the next one
+     * when it is taken.
+     */
+    template<typename K, typename V, unsigned Search = BinarySearch, size_t B = DEFAULT_BTREE_FACTOR,
+            typename Compare = std::less<K>>
+    class CombiningBTree {
+        enum : uint8_t {
+            FREE, WRITING, PENDING, DONE
+        };
+        enum : uint8_t {
+            INSERT, ERASE, GET
+        };
+
+        struct alignas(64) Slot {
+            std::atomic<uint8_t> state = FREE;
+            uint8_t kind;
+            std::optional<K> key;
+            std::optional<V> value; // the argument of an insert, then the result
+        };
+
+        Compare comp;
+        BTree<K, V, Search, B, Compare> tree;
+        std::unique_ptr<Slot[]> slots;
+        size_t count;
+        alignas(64) std::atomic<bool> combining = false;
+
+        static inline std::atomic<size_t> next_home = 0;
+
+        // test and test-and-set: waiters read the flag from their cache and only write it when it looks free
+        inline bool try_combine() {
+            return !combining.load(std::memory_order_relaxed) &&
+                   !combining.exchange(true, std::memory_order_acquire);
+        }
+
+        void combine() {
+            std::vector<Slot *> batch;
+            for (size_t i = 0; i < count; ++i) {
+                if (slots[i].state.load(std::memory_order_acquire) == PENDING) batch.push_back(&slots[i]);
+            }
+            std::stable_sort(batch.begin(), batch.end(), [&](Slot *a, Slot *b) { return comp(*a->key, *b->key); });
+            std::vector<K> keys;
+            for (auto slot: batch) {
+                if (keys.empty() || comp(keys.back(), *slot->key)) keys.push_back(*slot->key);
+            }
+            std::vector<typename BTree<K, V, Search, B, Compare>::iterator> found(keys.size());
+            tree.find_sorted(keys.begin(), keys.end(), found.begin());
+            // fold the operations on each key in order, answering each from the value the ones before it left
+            WriteBatch<K, V> writes;
+            for (size_t i = 0, k = 0; i < batch.size(); ++k) {
+                std::optional<V> current;
+                if (found[k] != tree.end()) current = (*found[k]).second;
+                bool written = false;
+                for (; i < batch.size() && !comp(keys[k], *batch[i]->key); ++i) {
+                    auto slot = batch[i];
+                    auto result = current;
+                    if (slot->kind == INSERT) {
+                        current = std::move(slot->value);
+                        written = true;
+                    } else if (slot->kind == ERASE) {
+                        current.reset();
+                        written = true;
+                    }
+                    slot->value = std::move(result);
+                }
+                if (!written) continue;
+                if (current) writes.put(keys[k], *current);
+                else writes.erase(keys[k]);
+            }
+            tree.apply(writes);
+            for (auto slot: batch) slot->state.store(DONE, std::memory_order_release);
+        }
+
+        std::optional<V> submit(uint8_t kind, const K &key, std::optional<V> value) {
+            static thread_local size_t home = next_home++;
+            Slot *slot;
+            for (size_t i = home;; ++i) {
+                slot = &slots[i % count];
+                uint8_t expected = FREE;
+                if (slot->state.compare_exchange_weak(expected, WRITING, std::memory_order_acquire)) break;
+            }
+            slot->kind = kind;
+            slot->key = key;
+            slot->value = std::move(value);
+            slot->state.store(PENDING, std::memory_order_release);
+            while (slot->state.load(std::memory_order_acquire) != DONE) {
+                if (try_combine()) {
+                    combine();
+                    combining.store(false, std::memory_order_release);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            auto result = std::move(slot->value);
+            slot->key.reset();
+            slot->state.store(FREE, std::memory_order_release);
+            return result;
+        }
+
+    public:
+        explicit CombiningBTree(size_t slot_count = 64, Compare comp = Compare())
+                : comp(comp), tree(comp), slots(std::make_unique<Slot[]>(slot_count)), count(slot_count) {}
+
+        // the previous value of the key, if there was one
+        std::optional<V> insert(const K &key, const V &value) {
+            return submit(INSERT, key, value);
+        }
+
+        // the erased value, if the key was present
+        std::optional<V> erase(const K &key) {
+            return submit(ERASE, key, std::nullopt);
+        }
+
+        std::optional<V> get(const K &key) {
+            return submit(GET, key, std::nullopt);
+        }
+
+        // run `f` on the tree as the combiner, e.g. for range scans
+        template<typename F>
+        auto locked(F f) {
+            while (!try_combine()) std::this_thread::yield();
+            struct Release {
+                std::atomic<bool> &flag;
+
+                ~Release() { flag.store(false, std::memory_order_release); }
+            } release{combining};
+            return f(tree);
+        }
+    };
+    /*
+     * Left-right wrapper for read-dominated trees: two replicas, one of which readers use while the writer
+     * updates the other. A write goes to the replica readers are not on, publishes it, waits until no reader
+     * can still be on the old one, and replays the write there. Readers only announce themselves on a counter
+     * and never wait or retry, whatever the writer does; writers are serialized and pay every write twice.
+     */
+    template<typename K, typename V, unsigned Search = BinarySearch, size_t B = DEFAULT_BTREE_FACTOR,
+            typename Compare = std::less<K>>
+    class LeftRightBTree {
+        using Tree = BTree<K, V, Search, B, Compare>;
+
+        Tree replicas[2];
+        std::atomic<unsigned> active = 0;  // the replica readers go to
+        std::atomic<unsigned> version = 0; // the read indicator new readers announce themselves on
+        struct alignas(64) Indicator {
+            std::atomic<size_t> readers = 0;
+        } indicators[2];
+        std::mutex writer;
+
+        // wait until every reader that might still see the replica readers left has departed
+        void drain() {
+            auto old = version.load();
+            auto next = old ^ 1u;
+            while (indicators[next].readers.load() != 0) std::this_thread::yield();
+            version.store(next);
+            while (indicators[old].readers.load() != 0) std::this_thread::yield();
+        }
+
+        template<typename F>
+        auto write(F f) {
+            std::lock_guard<std::mutex> guard(writer);
+            auto standby = active.load() ^ 1u;
+            f(replicas[standby]);
+            active.store(standby);
+            drain();
+            return f(replicas[standby ^ 1u]);
+        }
+
+    public:
+        explicit LeftRightBTree(Compare comp = Compare()) : replicas{Tree(comp), Tree(comp)} {}
+
+        // run the read-only `f` on the replica currently published to readers
+        template<typename F>
+        auto read(F f) {
+            auto &indicator = indicators[version.load()];
+            indicator.readers.fetch_add(1);
+            struct Departure {
+                Indicator &indicator;
+
+                ~Departure() { indicator.readers.fetch_sub(1); }
+            } departure{indicator};
+            return f(replicas[active.load()]);
+        }
+
+        std::optional<V> get(const K &key) {
+            return read([&](Tree &tree) -> std::optional<V> {
+                auto iter = tree.find(key);
+                if (iter != tree.end()) return (*iter).second;
+                return std::nullopt;
+            });
+        }
+
+        bool member(const K &key) {
+            return read([&](Tree &tree) { return tree.member(key); });
+        }
+
+        std::optional<V> insert(const K &key, const V &value) {
+            return write([&](Tree &tree) { return tree.insert(key, value); });
+        }
+
+        size_t erase(const K &key) {
+            return write([&](Tree &tree) { return tree.erase(key); });
+        }
+    };
+}
+
+#endif // BTREE_CONCURRENT_HPP
@@ -0,0 +1,267 @@
+#ifndef BTREE_MMAP_HPP
+#define BTREE_MMAP_HPP
+
+#include <btree.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace btree {
+
+    /*
+     * Read-only tree served straight from a memory-mapped file, so that opening it costs no load step and
+     * every process mapping the same file shares one page-cache copy. The file holds no pointers: the
+     * entries sit in key order as an array of keys and an array of values, and above them each index level
+     * keeps the first key of every `fanout` consecutive keys of the level below, up to a level of at most
+     * `fanout` keys. A lookup searches one run of `fanout` keys per level, and the header records where each
+     * level starts as an offset from the beginning of the file. Keys and values must be trivially copyable,
+     * and the file is read with the byte order and comparator it was written with.
+     */
+    template<typename K, typename V, typename Compare = std::less<K>>
+    class MappedBTree {
+        static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                      "mapped entries are used in place");
+
+        static constexpr size_t max_levels = 16;
+        static constexpr size_t align = 64;
+        static constexpr size_t default_fanout = std::max<size_t>(16, 4096 / sizeof(K));
+
+        struct Header {
+            char magic[8];
+            uint32_t key_size, value_size;
+            uint64_t count, fanout;
+            uint32_t levels, crc; // crc of the header with this field zero
+            uint64_t values;      // offset of the value array
+            uint64_t level[max_levels]; // offset of the key array of each level, the entries' own keys first
+        };
+
+        static constexpr char mapped_magic[8] = {'B', 'T', 'R', 'E', 'E', 'M', 'M', '1'};
+
+        Compare comp;
+        void *base = MAP_FAILED;
+        size_t length = 0;
+        const Header *header = nullptr;
+        const K *level[max_levels] = {};
+        size_t level_size[max_levels] = {};
+        const V *entries = nullptr;
+
+        static uint32_t checksum(Header h) {
+            h.crc = 0;
+            return __btree_impl::crc32(reinterpret_cast<const char *>(&h), sizeof(h));
+        }
+
+        static size_t above(size_t n, size_t fanout) {
+            return (n + fanout - 1) / fanout;
+        }
+
+        static size_t aligned(size_t offset) {
+            return (offset + align - 1) / align * align;
+        }
+
+        // the layout of a file of n entries; returns its length
+        static size_t plan(Header &h, size_t n, size_t fanout) {
+            std::memset(&h, 0, sizeof(h));
+            std::memcpy(h.magic, mapped_magic, sizeof(h.magic));
+            h.key_size = sizeof(K);
+            h.value_size = sizeof(V);
+            h.count = n;
+            h.fanout = fanout;
+            size_t offset = aligned(sizeof(Header));
+            h.values = offset;
+            offset = aligned(offset + n * sizeof(V));
+            for (size_t size = n;; size = above(size, fanout)) {
+                h.level[h.levels++] = offset;
+                offset = aligned(offset + size * sizeof(K));
+                if (size <= fanout) break;
+            }
+            return offset;
+        }
+
+        // take the tree at `data` if it fits in `size` bytes and its header is valid (and its crc, if `verify`):
+        // every field must be what writing `count` entries would have put there, down to the number of levels
+        void attach(const void *data, size_t size, bool verify) {
+            auto h = static_cast<const Header *>(data);
+            Header expected;
+            if (size < sizeof(Header) || std::memcmp(h->magic, mapped_magic, sizeof(h->magic)) != 0 ||
+                (verify && h->crc != checksum(*h)) || h->key_size != sizeof(K) || h->value_size != sizeof(V) ||
+                h->fanout < 16 || h->count > size / (sizeof(K) + sizeof(V)) ||
+                plan(expected, h->count, h->fanout) > size || expected.values != h->values ||
+                expected.levels != h->levels || std::memcmp(expected.level, h->level, sizeof(h->level)) != 0) {
+                return;
+            }
+            header = h;
+            auto bytes = static_cast<const char *>(data);
+            entries = reinterpret_cast<const V *>(bytes + h->values);
+            for (uint32_t l = 0; l < h->levels; ++l) {
+                level[l] = reinterpret_cast<const K *>(bytes + h->level[l]);
+                level_size[l] = l ? above(level_size[l - 1], h->fanout) : h->count;
+            }
+        }
+
+    public:
+        struct iterator {
+            const MappedBTree *tree;
+            size_t idx;
+
+            inline bool operator!=(const iterator &that) const noexcept {
+                return idx != that.idx;
+            }
+
+            inline bool operator==(const iterator &that) const noexcept {
+                return idx == that.idx;
+            }
+
+            iterator &operator++() {
+                ++idx;
+                return *this;
+            }
+
+            std::pair<const K &, const V &> operator*() const {
+                return {tree->level[0][idx], tree->entries[idx]};
+            }
+        };
+
+        explicit MappedBTree(const std::string &path, Compare comp = Compare()) : comp(comp) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return;
+            struct stat st{};
+            if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+                length = st.st_size;
+                base = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if (base != MAP_FAILED) attach(base, length, true);
+        }
+
+        // a view of a tree laid out in memory mapped by someone else, e.g. a slot of a `SharedBTree`; the
+        // layout is checked but not the checksum, as the memory was written by the program, not read from disk
+        MappedBTree(const void *data, size_t size, Compare comp = Compare()) : comp(comp) {
+            attach(data, size, false);
+        }
+
+        MappedBTree(const MappedBTree &) = delete;
+
+        ~MappedBTree() {
+            if (base != MAP_FAILED) ::munmap(base, length);
+        }
+
+        // false if the file could not be mapped or is not a tree of these key and value types
+        bool good() const {
+            return header != nullptr;
+        }
+
+        size_t size() const {
+            return header ? header->count : 0;
+        }
+
+        iterator begin() const {
+            return iterator{this, 0};
+        }
+
+        iterator end() const {
+            return iterator{this, size()};
+        }
+
+        // first entry not below `key`
+        iterator lower_bound(const K &key) const {
+            if (size() == 0) return end();
+            size_t block = 0; // run of the current level to search
+            for (auto l = header->levels; l-- > 1;) {
+                auto first = level[l] + block * header->fanout;
+                auto last = level[l] + std::min<size_t>((block + 1) * header->fanout, level_size[l]);
+                auto pos = std::upper_bound(first, last, key, comp) - level[l];
+                block = pos > 0 ? pos - 1 : 0;
+            }
+            auto first = level[0] + block * header->fanout;
+            auto last = level[0] + std::min<size_t>((block + 1) * header->fanout, header->count);
+            return iterator{this, size_t(std::lower_bound(first, last, key, comp) - level[0])};
+        }
+
+        iterator find(const K &key) const {
+            auto iter = lower_bound(key);
+            if (iter.idx == size() || comp(key, level[0][iter.idx])) return end();
+            return iter;
+        }
+
+        bool member(const K &key) const {
+            return find(key) != end();
+        }
+
+        // bytes of a file of `n` entries with this fanout
+        static size_t file_size(size_t n, size_t fanout = default_fanout) {
+            Header h;
+            return plan(h, n, fanout);
+        }
+
+        /*
+         * Lay the entries of `tree` (anything iterable in key order with `size()`) out as a mapped tree at
+         * `offset` of the file `fd`, in one pass, writing the header last. A lookup reads about
+         * log_fanout(n) runs of `fanout` (at least 16) keys; the default fills a 4 KiB page per run.
+         */
+        template<typename Tree>
+        static bool write_at(Tree &tree, int fd, size_t offset, size_t fanout = default_fanout) {
+            if (fanout < 16) return false;
+            Header h;
+            auto n = size_t(tree.size());
+            plan(h, n, fanout);
+            h.crc = checksum(h);
+            bool ok = true;
+            std::string key_buffer, value_buffer;
+            size_t keys_done = 0, values_done = 0;
+            auto flush = [&](std::string &buffer, size_t &done, size_t at) {
+                ok = ok && ::pwrite(fd, buffer.data(), buffer.size(), off_t(offset + at + done)) ==
+                           ssize_t(buffer.size());
+                done += buffer.size();
+                buffer.clear();
+            };
+            std::vector<K> index; // the first level above the entries; the rest is derived from it
+            size_t i = 0;
+            for (auto entry: tree) {
+                if (i++ % fanout == 0) index.push_back(entry.first);
+                codec<K>::put(key_buffer, entry.first);
+                codec<V>::put(value_buffer, entry.second);
+                if (key_buffer.size() >= (1 << 20)) flush(key_buffer, keys_done, h.level[0]);
+                if (value_buffer.size() >= (1 << 20)) flush(value_buffer, values_done, h.values);
+            }
+            flush(key_buffer, keys_done, h.level[0]);
+            flush(value_buffer, values_done, h.values);
+            ok = ok && i == n;
+            for (uint32_t l = 1; l < h.levels; ++l) {
+                for (auto &key: index) codec<K>::put(key_buffer, key);
+                size_t done = 0;
+                flush(key_buffer, done, h.level[l]);
+                std::vector<K> up;
+                for (size_t j = 0; j < index.size(); j += fanout) up.push_back(index[j]);
+                index.swap(up);
+            }
+            return ok && ::pwrite(fd, &h, sizeof(h), off_t(offset)) == ssize_t(sizeof(h));
+        }
+
+        // write_at into a file next to `path` that is then synced and renamed over it, with the rename synced too
+        template<typename Tree>
+        static bool write(Tree &tree, const std::string &path, size_t fanout = default_fanout) {
+            if (fanout < 16) return false;
+            auto next = path + ".tmp";
+            int fd = ::open(next.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) return false;
+            bool ok = ::ftruncate(fd, off_t(file_size(tree.size(), fanout))) == 0 && write_at(tree, fd, 0, fanout) &&
+                      ::fdatasync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
+            if (!ok || ::rename(next.c_str(), path.c_str()) != 0) {
+                ::unlink(next.c_str());
+                return false;
+            }
+            return __btree_impl::sync_parent(path);
+        }
+    };
+}
+
+#endif // BTREE_MMAP_HPP
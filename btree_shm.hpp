@@ -0,0 +1,214 @@
+#ifndef BTREE_SHM_HPP
+#define BTREE_SHM_HPP
+
+#include <btree_mmap.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace btree {
+
+    /*
+     * Tree shared by the processes of one machine through shared memory, read in place by all of them and
+     * published by one at a time. The region holds a control block and two slots, each laid out as a
+     * `MappedBTree` (offsets only, no pointers, so every process may map it anywhere). `publish` writes a
+     * whole tree into the slot readers are not on and then switches readers over to it, so every update
+     * costs O(n) in the size of the tree, however little of it changed: this suits an index republished
+     * now and then, not one updated entry by entry. `read` pins the current slot for as long as it runs.
+     * Pins are counted per slot in the region (a process-shared left-right scheme), so `publish` waits only
+     * for readers still on the slot it is about to overwrite. Readers never block on a publisher: a reader
+     * that pins a slot just as a publication switches away from it unpins and retries on the new one. A
+     * reader that dies while pinned keeps its slot pinned, and `publish` then waits for good; likewise a
+     * publisher that dies inside `publish` never gives its turn back, and every later `publish` waits
+     * forever. The region must then be created again under its name and opened anew.
+     *
+     * A region is created either under a name (`shm_open`), which other processes open by name, or
+     * unnamed (`memfd_create`), which is shared with the processes forked after it is created. Keys and
+     * values must be trivially copyable, and every process must use the same types, comparator and build.
+     */
+    template<typename K, typename V, typename Compare = std::less<K>>
+    class SharedBTree {
+        using View = MappedBTree<K, V, Compare>;
+
+        static_assert(std::atomic<uint32_t>::is_always_lock_free, "pins are shared between processes");
+
+        static constexpr size_t page = 4096;
+
+        struct Control {
+            std::atomic<uint64_t> magic;      // stored last, once the region is ready to be opened
+            uint32_t key_size, value_size;
+            uint64_t slot_size;
+            std::atomic<uint32_t> active;    // slot new readers go to
+            std::atomic<uint32_t> publishing; // taken by the process that publishes
+            std::atomic<uint64_t> generation; // publications so far
+            struct alignas(64) Pins {
+                std::atomic<uint32_t> readers;
+            } pins[2];
+        };
+
+        static constexpr char shared_magic[8] = {'B', 'T', 'R', 'E', 'E', 'S', 'H', '1'};
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "the magic is shared between processes");
+
+        static uint64_t magic_word() {
+            uint64_t word;
+            std::memcpy(&word, shared_magic, sizeof(word));
+            return word;
+        }
+        static constexpr size_t control_size = (sizeof(Control) + page - 1) / page * page;
+
+        int fd = -1;
+        Control *control = nullptr;
+        char *base = nullptr;
+        size_t length = 0;
+        Compare comp;
+
+        bool map(size_t size) {
+            auto at = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (at == MAP_FAILED) return false;
+            base = static_cast<char *>(at);
+            length = size;
+            control = reinterpret_cast<Control *>(base);
+            return true;
+        }
+
+        // size the new region, publish an empty tree into slot 0, and only then mark it as ready to open
+        void create(size_t slot_bytes) {
+            auto slot_size = (slot_bytes + page - 1) / page * page;
+            if (fd < 0 || ::ftruncate(fd, off_t(control_size + 2 * slot_size)) != 0 ||
+                !map(control_size + 2 * slot_size)) {
+                return;
+            }
+            new(&control->magic) std::atomic<uint64_t>(0);
+            control->key_size = sizeof(K);
+            control->value_size = sizeof(V);
+            control->slot_size = slot_size;
+            new(&control->active) std::atomic<uint32_t>(0);
+            new(&control->publishing) std::atomic<uint32_t>(0);
+            new(&control->generation) std::atomic<uint64_t>(0);
+            for (auto &pin: control->pins) new(&pin.readers) std::atomic<uint32_t>(0);
+            std::vector<std::pair<K, V>> none;
+            if (slot_size < View::file_size(0) || !View::write_at(none, fd, control_size, 16)) {
+                ::munmap(base, length);
+                control = nullptr;
+                return;
+            }
+            control->magic.store(magic_word(), std::memory_order_release);
+        }
+
+        char *slot(uint32_t i) const {
+            return base + control_size + i * control->slot_size;
+        }
+
+    public:
+        // a new unnamed region, shared with the processes forked from now on
+        explicit SharedBTree(size_t slot_bytes, Compare comp = Compare()) : comp(comp) {
+            fd = ::memfd_create("btree", MFD_CLOEXEC);
+            create(slot_bytes);
+        }
+
+        // a new region under `name` (replacing any left by an earlier run) for other processes to open.
+        // The old name is dropped rather than truncated, so processes still on the old region keep it intact.
+        SharedBTree(const std::string &name, size_t slot_bytes, Compare comp = Compare()) : comp(comp) {
+            ::shm_unlink(name.c_str());
+            fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            create(slot_bytes);
+        }
+
+        // the region created under `name`, once its creator has finished setting it up
+        explicit SharedBTree(const std::string &name, Compare comp = Compare()) : comp(comp) {
+            fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+            struct stat st{};
+            if (fd < 0 || ::fstat(fd, &st) != 0 || size_t(st.st_size) < control_size || !map(st.st_size)) return;
+            if (control->magic.load(std::memory_order_acquire) != magic_word() ||
+                control->key_size != sizeof(K) || control->value_size != sizeof(V) ||
+                control_size + 2 * control->slot_size > length) {
+                ::munmap(base, length);
+                control = nullptr;
+            }
+        }
+
+        SharedBTree(const SharedBTree &) = delete;
+
+        ~SharedBTree() {
+            if (control) ::munmap(base, length);
+            if (fd >= 0) ::close(fd);
+        }
+
+        // drop the name; processes that opened the region keep it until they unmap it
+        static bool remove(const std::string &name) {
+            return ::shm_unlink(name.c_str()) == 0;
+        }
+
+        // false if the region could not be created or opened, or holds other key or value types
+        bool good() const {
+            return control != nullptr;
+        }
+
+        // number of trees published so far
+        uint64_t generation() const {
+            return control->generation.load(std::memory_order_acquire);
+        }
+
+        /*
+         * Make the entries of `tree` (anything iterable in key order with `size()`) what readers see from now
+         * on, by writing all of them into the other slot. Concurrent publishers take turns; a publisher that
+         * dies during its turn keeps it for good. Returns false if the tree does not fit in a slot.
+         */
+        template<typename Tree>
+        bool publish(Tree &tree) {
+            if (View::file_size(tree.size()) > control->slot_size) return false;
+            while (control->publishing.exchange(1, std::memory_order_acquire)) std::this_thread::yield();
+            auto next = 1 - control->active.load();
+            // readers that found `next` active before the last switch see it is no longer and leave
+            while (control->pins[next].readers.load()) std::this_thread::yield();
+            bool ok = View::write_at(tree, fd, size_t(slot(next) - base));
+            if (ok) {
+                control->active.store(next);
+                control->generation.fetch_add(1, std::memory_order_release);
+            }
+            control->publishing.store(0, std::memory_order_release);
+            return ok;
+        }
+
+        // run `f` on a `MappedBTree` view of the current tree, which stays as it is until `f` returns
+        template<typename F>
+        auto read(F f) const {
+            uint32_t at;
+            while (true) {
+                at = control->active.load();
+                control->pins[at].readers.fetch_add(1);
+                if (control->active.load() == at) break;
+                control->pins[at].readers.fetch_sub(1, std::memory_order_release);
+            }
+            struct Unpin {
+                std::atomic<uint32_t> &readers;
+
+                ~Unpin() {
+                    readers.fetch_sub(1, std::memory_order_release);
+                }
+            } unpin{control->pins[at].readers};
+            const View view(slot(at), control->slot_size, comp);
+            return f(view);
+        }
+
+        std::optional<V> get(const K &key) const {
+            return read([&](const View &view) -> std::optional<V> {
+                auto iter = view.find(key);
+                if (iter == view.end()) return std::nullopt;
+                return (*iter).second;
+            });
+        }
+
+        size_t size() const {
+            return read([](const View &view) { return view.size(); });
+        }
+    };
+}
+
+#endif // BTREE_SHM_HPP
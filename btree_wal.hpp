@@ -0,0 +1,340 @@
+#ifndef BTREE_WAL_HPP
+#define BTREE_WAL_HPP
+
+#include <btree.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace btree {
+
+    /*
+     * Append-only file of records, each framed as its length, its CRC-32 and the payload. Appending only
+     * buffers the record; `commit(lsn)` returns once the record is on disk. The first committer to find no
+     * write in progress writes and syncs everything appended so far, and the threads that appended meanwhile
+     * wait for it and are covered by the next such write, so one fdatasync serves a whole group of records.
+     */
+    class WriteAheadLog {
+        int fd = -1;
+        std::mutex lock;
+        std::condition_variable flushed;
+        std::string pending, writing;
+        uint64_t appended = 0, durable = 0;
+        uint64_t lost_after = 0, lost_upto = 0; // records in (lost_after, lost_upto] never reached the file
+        bool flushing = false;
+        bool failed = false;
+
+        // with the lock held: nothing buffered now can be written any more
+        void lose() {
+            if (!lost_upto) lost_after = durable;
+            lost_upto = appended;
+            pending.clear();
+        }
+
+    public:
+        // `keep` cuts the file to that length first, dropping a torn tail left by a crash
+        explicit WriteAheadLog(const std::string &path, size_t keep = SIZE_MAX) {
+            open(path, keep);
+        }
+
+        WriteAheadLog(const WriteAheadLog &) = delete;
+
+        ~WriteAheadLog() {
+            sync();
+            if (fd >= 0) ::close(fd);
+        }
+
+        // switch to appending to `path`, e.g. after it was replaced by a compacted log; no commit may be waiting
+        bool open(const std::string &path, size_t keep = SIZE_MAX) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (fd >= 0) ::close(fd);
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            failed = fd < 0 || (keep != SIZE_MAX && ::ftruncate(fd, off_t(keep)) != 0);
+            if (failed) lose();
+            return !failed;
+        }
+
+        // false once opening, writing or syncing failed; later records are not durable
+        bool good() {
+            std::lock_guard<std::mutex> guard(lock);
+            return !failed;
+        }
+
+        // the sequence number to commit; once the log failed, the record is dropped and its commit fails
+        uint64_t append(const std::string &payload) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (failed) {
+                ++appended;
+                lose();
+                return appended;
+            }
+            codec<uint32_t>::put(pending, uint32_t(payload.size()));
+            codec<uint32_t>::put(pending, __btree_impl::crc32(payload.data(), payload.size()));
+            pending.append(payload);
+            return ++appended;
+        }
+
+        bool commit(uint64_t lsn) {
+            std::unique_lock<std::mutex> guard(lock);
+            while (durable < lsn && !failed) {
+                if (flushing) {
+                    flushed.wait(guard);
+                    continue;
+                }
+                flushing = true;
+                writing.swap(pending);
+                auto upto = appended;
+                guard.unlock();
+                bool ok = __btree_impl::write_all(fd, writing) && ::fdatasync(fd) == 0;
+                writing.clear();
+                guard.lock();
+                flushing = false;
+                if (ok) {
+                    durable = upto;
+                } else {
+                    failed = true;
+                    lose();
+                }
+                flushed.notify_all();
+            }
+            return !failed && (lsn <= lost_after || lsn > lost_upto);
+        }
+
+        bool sync() {
+            uint64_t lsn;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                lsn = appended;
+            }
+            return commit(lsn);
+        }
+
+        /*
+         * Call `f(payload, end)` for the records of the log at `path` in order, stopping at the first one that
+         * is cut short or fails its checksum (the tail of a crash). Returns the length of the intact prefix.
+         */
+        template<typename F>
+        static size_t replay(const std::string &path, F f) {
+            std::ifstream in(path, std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            const char *at = data.data(), *end = data.data() + data.size();
+            while (true) {
+                auto start = at;
+                auto length = codec<uint32_t>::get(at, end);
+                auto crc = codec<uint32_t>::get(at, end);
+                if (!length || !crc || size_t(end - at) < *length || __btree_impl::crc32(at, *length) != *crc) {
+                    return start - data.data();
+                }
+                f(at, at + *length);
+                at += *length;
+            }
+        }
+    };
+
+    /*
+     * A tree whose writes are logged before they are made: `insert`, `erase` and `apply` append one record
+     * each (a batch is one record, so it is recovered whole or not at all), wait for its group commit and
+     * only then change the tree, in the order the records were appended. A write whose record could not be
+     * made durable is not applied and returns nullopt; `good` stays false from then on. Opening an existing
+     * log replays it, bulk-loading the sorted entries a compaction wrote at its start. `compact` rewrites
+     * the log as the current contents so that recovery does not replay the history. Reads go through `read`.
+     */
+    template<typename K, typename V, unsigned Search = BinarySearch, size_t B = DEFAULT_BTREE_FACTOR,
+            typename Compare = std::less<K>>
+    class DurableBTree {
+        using Tree = BTree<K, V, Search, B, Compare>;
+
+        enum : uint8_t {
+            INSERT, ERASE, BATCH, SORTED
+        };
+
+        static constexpr size_t sorted_chunk = 4096; // entries per record of a compacted log
+
+        std::string path;
+        size_t intact = 0; // length of the log that recovery could read
+        Tree tree;
+        WriteAheadLog log;
+        std::mutex writer;
+        std::condition_variable turn;
+        uint64_t issued = 0, applied = 0; // the last record appended, and the last one applied to the tree
+        bool compacting = false;
+
+        static Tree recover(const std::string &path, Compare comp, size_t &intact) {
+            std::vector<std::pair<K, V>> sorted;
+            std::vector<std::string> rest;
+            intact = WriteAheadLog::replay(path, [&](const char *at, const char *end) {
+                if (at == end) return;
+                if (*at == SORTED && rest.empty()) {
+                    auto count = codec<uint32_t>::get(++at, end);
+                    for (uint32_t i = 0; i < *count; ++i) {
+                        auto key = codec<K>::get(at, end);
+                        auto value = codec<V>::get(at, end);
+                        sorted.emplace_back(std::move(*key), std::move(*value));
+                    }
+                } else {
+                    rest.emplace_back(at, end);
+                }
+            });
+            auto tree = Tree::from_sorted(sorted.begin(), sorted.end(), comp);
+            for (auto &record: rest) {
+                const char *at = record.data() + 1, *end = record.data() + record.size();
+                switch (record[0]) {
+                    case INSERT: {
+                        auto key = codec<K>::get(at, end);
+                        tree.insert(*key, *codec<V>::get(at, end));
+                        break;
+                    }
+                    case ERASE:
+                        tree.erase(*codec<K>::get(at, end));
+                        break;
+                    default: {
+                        WriteBatch<K, V> batch;
+                        auto count = codec<uint32_t>::get(at, end);
+                        for (uint32_t i = 0; i < *count; ++i) {
+                            auto present = codec<uint8_t>::get(at, end);
+                            auto key = codec<K>::get(at, end);
+                            if (*present) batch.put(*key, *codec<V>::get(at, end));
+                            else batch.erase(*key);
+                        }
+                        tree.apply(batch);
+                    }
+                }
+            }
+            return tree;
+        }
+
+        // append `record`, wait until it is durable, then run `change` on the tree once the records before it ran
+        template<typename F>
+        auto logged(const std::string &record, F change) -> std::optional<decltype(change())> {
+            std::unique_lock<std::mutex> guard(writer);
+            turn.wait(guard, [&] { return !compacting; });
+            auto lsn = issued = log.append(record);
+            guard.unlock();
+            bool durable = log.commit(lsn);
+            guard.lock();
+            turn.wait(guard, [&] { return applied + 1 == lsn; });
+            std::optional<decltype(change())> result;
+            if (durable) result.emplace(change());
+            applied = lsn;
+            turn.notify_all();
+            return result;
+        }
+
+        bool rewrite() {
+            if (!log.sync()) return false;
+            auto next = path + ".compact";
+            int fd = ::open(next.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) return false;
+            std::string data, record;
+            auto flush = [&](uint32_t count) {
+                std::memcpy(record.data() + 1, &count, sizeof(count));
+                codec<uint32_t>::put(data, uint32_t(record.size()));
+                codec<uint32_t>::put(data, __btree_impl::crc32(record.data(), record.size()));
+                data.append(record);
+            };
+            uint32_t count = 0;
+            for (auto iter = tree.begin(); iter != tree.end(); ++iter) {
+                if (count == 0) {
+                    record.assign(1, char(SORTED));
+                    codec<uint32_t>::put(record, 0);
+                }
+                codec<K>::put(record, (*iter).first);
+                codec<V>::put(record, (*iter).second);
+                if (++count == sorted_chunk) {
+                    flush(count);
+                    count = 0;
+                }
+            }
+            if (count) flush(count);
+            bool ok = __btree_impl::write_all(fd, data) && ::fdatasync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
+            if (!ok || ::rename(next.c_str(), path.c_str()) != 0) {
+                ::unlink(next.c_str());
+                return false;
+            }
+            bool renamed = __btree_impl::sync_parent(path);
+            return log.open(path) && renamed;
+        }
+
+    public:
+        explicit DurableBTree(const std::string &path, Compare comp = Compare())
+                : path(path), tree(recover(path, comp, intact)), log(path, intact) {}
+
+        // false once the log could not be opened, written or synced
+        bool good() {
+            return log.good();
+        }
+
+        // the previous value of the key, if there was one; nullopt if the write could not be logged
+        std::optional<std::optional<V>> insert(const K &key, const V &value) {
+            std::string record(1, char(INSERT));
+            codec<K>::put(record, key);
+            codec<V>::put(record, value);
+            return logged(record, [&] { return tree.insert(key, value); });
+        }
+
+        // the number of entries erased; nullopt if the write could not be logged
+        std::optional<size_t> erase(const K &key) {
+            std::string record(1, char(ERASE));
+            codec<K>::put(record, key);
+            return logged(record, [&] { return tree.erase(key); });
+        }
+
+        // the batch is consumed; returns the number of entries erased, or nullopt if it could not be logged
+        std::optional<size_t> apply(WriteBatch<K, V> &batch) {
+            std::string record(1, char(BATCH));
+            codec<uint32_t>::put(record, uint32_t(batch.size()));
+            batch.for_each([&](const K &key, const std::optional<V> &value) {
+                codec<uint8_t>::put(record, value.has_value());
+                codec<K>::put(record, key);
+                if (value) codec<V>::put(record, *value);
+            });
+            return logged(record, [&] { return tree.apply(batch); });
+        }
+
+        // run the read-only `f` on the tree with writers held off
+        template<typename F>
+        auto read(F f) {
+            std::lock_guard<std::mutex> guard(writer);
+            return f(tree);
+        }
+
+        std::optional<V> get(const K &key) {
+            return read([&](Tree &t) -> std::optional<V> {
+                auto iter = t.find(key);
+                if (iter != t.end()) return (*iter).second;
+                return std::nullopt;
+            });
+        }
+
+        /*
+         * Replace the log by the current entries in key order, written next to it, synced and renamed over
+         * it, so that recovery is a bulk load rather than a replay of every write. Writers wait meanwhile.
+         */
+        bool compact() {
+            std::unique_lock<std::mutex> guard(writer);
+            turn.wait(guard, [&] { return !compacting; });
+            // hold off new records and let the ones already appended reach the tree before it is written out
+            compacting = true;
+            turn.wait(guard, [&] { return applied == issued; });
+            auto ok = rewrite();
+            compacting = false;
+            turn.notify_all();
+            return ok;
+        }
+
+        size_t size() {
+            return read([](Tree &t) { return t.size(); });
+        }
+    };
+}
+
+#endif // BTREE_WAL_HPP
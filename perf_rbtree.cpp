@@ -30,6 +30,27 @@ struct Rng {
     }
 };
 
+// membership of `codata` in a btree holding `data`, set up by `before` ahead of the inserts and `after` them
+template<typename Before, typename After>
+int btree_membership(const char *variant, const std::vector<int> &data, const std::vector<int> &codata,
+                     Before before, After after) {
+    auto limit = 10'000'000;
+    std::cout << limit << " membership (" << variant << ")" << std::endl;
+    BTree<int, int> tester;
+    before(tester);
+    for (int i = 0; i < limit; ++i) {
+        tester.insert(data[i], data[i]);
+    }
+    after(tester);
+    auto found = 0;
+    timeit([&] {
+        for (int i = 0; i < limit; ++i) {
+            found += tester.member(codata[i]);
+        }
+    });
+    return found;
+}
+
 int main() {
     auto rng = Rng();
     std::vector<int> data(10'000'000);
@@ -76,21 +97,15 @@ int main() {
         });
     }
 
-    auto N = 0;
-    {
-        auto limit = 10'000'000;
-        std::cout << limit << " membership (btree)" << std::endl;
-        BTree<int, int> tester;
-        for (int i = 0; i < limit; ++i) {
-            tester.insert(data[i], data[i]);
-        }
-        timeit([&] {
-            for (int i = 0; i < limit; ++i) {
-                N += tester.member(codata[i]);
-            }
-        });
-    }
-    if (M != N) std::abort();
+    auto none = [](BTree<int, int> &) {};
+    if (btree_membership("btree", data, codata, none, none) != M) std::abort();
+    if (btree_membership("btree, radix", data, codata, [](auto &t) { t.enable_radix(16); }, none) != M) std::abort();
+    if (btree_membership("btree, learned index", data, codata, none, [](auto &t) { t.build_learned_index(); }) != M)
+        std::abort();
+    if (btree_membership("btree, hash index", data, codata, [](auto &t) { t.enable_hash_index(); }, none) != M)
+        std::abort();
+    if (btree_membership("btree, bloom filter", data, codata, [](auto &t) { t.enable_bloom_filter(); }, none) != M)
+        std::abort();
     {
         auto limit = 10'000'000;
         std::cout << limit << " erase min (map)" << std::endl;
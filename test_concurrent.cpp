@@ -0,0 +1,262 @@
+#include <vector>
+#include <random>
+#include <thread>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree_concurrent.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree>
+void combining(unsigned threads, size_t slots) {
+    Tree test(slots);
+    std::vector<std::thread> workers;
+    // every thread owns the keys congruent to its id, and reads everybody's
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 engine(t);
+            for (long i = 0; i < LIMIT / threads; ++i) {
+                long k = i * threads + t;
+                ASSERT(!test.insert(k, k));
+                ASSERT(*test.insert(k, -k) == k);
+                if (i % 3 == 0) {
+                    ASSERT(*test.erase(k) == -k);
+                    ASSERT(!test.erase(k));
+                }
+                auto other = long(engine() % LIMIT);
+                auto found = test.get(other);
+                ASSERT(!found || *found == other || *found == -other);
+            }
+        });
+    }
+    for (auto &worker: workers) worker.join();
+    test.locked([&](auto &tree) {
+        long expected = 0;
+        for (auto i : tree) {
+            while (expected / threads % 3 == 0) expected++;
+            ASSERT(i.first == expected);
+            ASSERT(i.second == -expected);
+            expected++;
+        }
+        return 0;
+    });
+}
+
+void left_right(unsigned readers) {
+    LeftRightBTree<long, long> test;
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> workers;
+    // the writer inserts k before k + LIMIT and erases them the other way round
+    for (unsigned t = 0; t < readers; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 engine(t);
+            while (!stop.load()) {
+                auto k = long(engine() % (LIMIT / 20));
+                test.read([&](auto &tree) {
+                    auto low = tree.find(k), high = tree.find(k + LIMIT);
+                    if (high != tree.end()) {
+                        ASSERT(low != tree.end());
+                        ASSERT((*low).second == (*high).second);
+                    }
+                    return 0;
+                });
+                auto found = test.get(k);
+                ASSERT(!found || *found >= 0);
+                std::this_thread::yield();
+            }
+        });
+    }
+    std::mt19937_64 engine(readers);
+    std::map<long, long> a;
+    for (int i = 0; i < LIMIT / 10; ++i) {
+        auto k = long(engine() % (LIMIT / 20));
+        if (a.count(k)) {
+            ASSERT(test.erase(k + LIMIT) == 1);
+            ASSERT(test.erase(k) == 1);
+            a.erase(k);
+        } else {
+            a[k] = i;
+            test.insert(k, i);
+            test.insert(k + LIMIT, i);
+        }
+    }
+    stop = true;
+    for (auto &worker: workers) worker.join();
+    for (auto &i : a) {
+        ASSERT(test.member(i.first) && test.member(i.first + LIMIT));
+        ASSERT(*test.get(i.first) == i.second);
+    }
+}
+
+template<typename Snapshot>
+void same(Snapshot &snap, const std::map<long, long> &expected) {
+    ASSERT(snap.size() == expected.size());
+    auto iter = expected.begin();
+    snap.for_each([&](const long &key, const long &value) {
+        ASSERT(iter != expected.end() && iter->first == key && iter->second == value);
+        ++iter;
+    });
+    ASSERT(iter == expected.end());
+}
+
+// snapshots taken between writes keep their view through inserts, erases and batches
+void snapshots(int accelerate) {
+    using Tree = BTree<long, long>;
+    Tree test;
+    if (accelerate == 1) test.enable_hash_index();
+    if (accelerate == 2) test.enable_radix(8);
+    if (accelerate == 3) test.enable_bloom_filter();
+    std::map<long, long> a;
+    std::vector<std::pair<Tree::Snapshot, std::map<long, long>>> live;
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = long(rand() % (LIMIT / 4));
+        if (i % 7 == 0) {
+            ASSERT(test.erase(k) == a.erase(k));
+        } else if (i % 211 == 0) {
+            WriteBatch<long, long> batch;
+            for (long j = 0; j < 64; ++j) {
+                if (j % 3) batch.put(k + j, -i), a[k + j] = -i;
+                else batch.erase(k + j), a.erase(k + j);
+            }
+            test.apply(batch);
+        } else {
+            test.insert(k, i);
+            a[k] = i;
+        }
+        if (i % 997 == 0) live.emplace_back(test.snapshot(), a);
+        if (i % 1499 == 0 && !live.empty()) live.erase(live.begin() + rand() % live.size());
+    }
+    for (auto &[snap, expected]: live) {
+        same(snap, expected);
+        for (long k = 0; k < LIMIT / 4; k += 13) {
+            auto found = snap.get(k);
+            ASSERT(expected.count(k) ? found && *found == expected[k] : !found);
+        }
+    }
+    live.clear();
+    for (auto &i : a) {
+        auto iter = test.find(i.first);
+        ASSERT(iter != test.end() && (*iter).second == i.second);
+    }
+    ASSERT(test.size() == a.size());
+}
+
+// copying a leaf root out of a snapshot replaces the root every radix slot points at
+void radix_snapshot() {
+    BTree<long, long> test;
+    test.enable_radix(8);
+    for (long k = 0; k < 50; k += 10) test.insert(k, k);
+    {
+        auto snap = test.snapshot();
+        test.insert(25, 25);
+        ASSERT(test.size() == 6 && snap.size() == 5);
+        ASSERT(test.member(25) && test.find(25) != test.end());
+        ASSERT(!snap.get(25));
+    }
+    test.insert(35, 35);
+    for (long k = 0; k < 50; k += 5) ASSERT(test.member(k) == (k % 10 == 0 || k == 25 || k == 35));
+}
+
+// readers scan snapshots on their own threads while the writer goes on
+void snapshot_readers(unsigned readers) {
+    using Tree = BTree<long, long>;
+    Tree test;
+    std::map<long, long> a;
+    std::mt19937_64 engine(readers);
+    for (unsigned round = 0; round < 4; ++round) {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < readers; ++t) {
+            workers.emplace_back([snap = test.snapshot(), expected = a]() mutable {
+                same(snap, expected);
+                for (auto &[key, value]: expected) ASSERT(*snap.get(key) == value);
+            });
+        }
+        for (int i = 0; i < LIMIT / 4; ++i) {
+            auto k = long(engine() % (LIMIT / 4));
+            if (i % 3 == 0) {
+                ASSERT(test.erase(k) == a.erase(k));
+            } else {
+                test.insert(k, i);
+                a[k] = i;
+            }
+        }
+        for (auto &worker: workers) worker.join();
+    }
+    same(*std::make_unique<Tree::Snapshot>(test.snapshot()), a);
+}
+
+// keys divisible by 4 are never erased; every value is its key or its negation
+void optimistic(unsigned readers) {
+    BTree<long, long> test;
+    for (long k = 0; k < LIMIT / 4; k += 4) test.insert(k, k);
+    test.enable_optimistic_reads();
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < readers; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 engine(t);
+            for (size_t i = 0; !stop.load(); ++i) {
+                auto k = long(engine() % (LIMIT / 4));
+                auto found = test.lookup(k);
+                ASSERT(k % 4 != 0 || found);
+                ASSERT(!found || *found == k || *found == -k);
+                // readers stick to the calls that copy out what they find; iterators are the writer's
+                ASSERT(k % 4 != 0 || test.member(k));
+                if (i % 64 == 0) std::this_thread::yield();
+            }
+        });
+    }
+    std::mt19937_64 engine(readers);
+    std::map<long, long> a;
+    for (long k = 0; k < LIMIT / 4; k += 4) a[k] = k;
+    for (int i = 0; i < 2 * LIMIT; ++i) {
+        auto k = long(engine() % (LIMIT / 4));
+        if (k % 4 && a.count(k)) {
+            ASSERT(test.erase(k) == 1);
+            a.erase(k);
+        } else {
+            a[k] = i % 2 ? k : -k;
+            test.insert(k, a[k]);
+        }
+        // find hands out an iterator, so only the writer calls it while the readers run
+        if (i % 16 == 0) ASSERT((test.find(k) != test.end()) == a.count(k));
+    }
+    stop = true;
+    for (auto &worker: workers) worker.join();
+    for (long k = 0; k < LIMIT / 4; ++k) {
+        auto found = test.lookup(k);
+        ASSERT(a.count(k) ? found && *found == a[k] : !found);
+        ASSERT(test.member(k) == a.count(k));
+        auto iter = test.find(k);
+        ASSERT(a.count(k) ? iter != test.end() && (*iter).second == a[k] : !(iter != test.end()));
+    }
+    test.disable_optimistic_reads();
+    for (long k = 0; k < LIMIT / 4; ++k) {
+        auto found = test.lookup(k);
+        ASSERT(a.count(k) ? found && *found == a[k] : !found);
+    }
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    combining<CombiningBTree<long, long>>(4, 64);
+    combining<CombiningBTree<long, long>>(8, 2);
+    combining<CombiningBTree<long, long>>(1, 1);
+    left_right(4);
+    left_right(1);
+    for (int accelerate = 0; accelerate < 4; ++accelerate) snapshots(accelerate);
+    radix_snapshot();
+    snapshot_readers(3);
+    snapshot_readers(1);
+    optimistic(3);
+    optimistic(1);
+    ASSERT(alive_node == 0);
+    return 0;
+}
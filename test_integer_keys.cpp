@@ -0,0 +1,122 @@
+#include <vector>
+#include <random>
+#include <climits>
+#include <limits>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <set>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename K, size_t Factor, unsigned Search = BinarySearch, typename Gen>
+void check(Gen gen) {
+    std::set<K> a;
+    BTree<K, K, Search, Factor> test;
+    for (int i = 0; i < LIMIT; ++i) {
+        K k = gen();
+        a.insert(k);
+        test.insert(k, k);
+    }
+    ASSERT(a.size() == test.size());
+    auto iter = a.begin();
+    for (auto i : test) {
+        ASSERT(i.first == *iter);
+        ASSERT(i.second == *iter);
+        ++iter;
+    }
+    for (int i = 0; i < LIMIT; ++i) {
+        K k = gen();
+        ASSERT(test.member(k) == a.count(k));
+    }
+    for (auto k : {std::numeric_limits<K>::min(), std::numeric_limits<K>::max(), K(0), K(-1), K(1)}) {
+        ASSERT(test.member(k) == a.count(k));
+    }
+    while (!test.empty()) {
+        if (rand() & 1) {
+            ASSERT(test.min_key() == *a.begin());
+            test.pop_min();
+            a.erase(a.begin());
+        } else {
+            ASSERT(test.max_key() == *a.rbegin());
+            test.pop_max();
+            a.erase(std::prev(a.end()));
+        }
+        if (!a.empty()) {
+            auto k = *a.begin() + K(rand() % 3);
+            ASSERT(test.member(k) == a.count(k));
+        }
+    }
+}
+
+// walk a set of leaves through the representations: dense keys, then wider gaps, then keys far apart
+template<typename K>
+void switching() {
+    std::set<K> a;
+    BTree<K, K, BinarySearch, 8> test;
+    auto agree = [&] {
+        ASSERT(a.size() == test.size());
+        auto iter = a.begin();
+        for (auto i : test) {
+            ASSERT(i.first == *iter);
+            ++iter;
+        }
+        for (auto k : a) {
+            ASSERT(test.member(k));
+            ASSERT(test.member(K(k + 1)) == a.count(K(k + 1)));
+        }
+    };
+    K next = 0;
+    for (K step : {K(1), K(3), K(200)}) {
+        for (size_t i = 0; i < size_t(2000 / step + 100); ++i, next += step) {
+            a.insert(next);
+            test.insert(next, next);
+        }
+        agree();
+    }
+    K far = std::numeric_limits<K>::max() / 4 * 3;
+    for (int i = 0; i < 64; ++i) {
+        a.insert(K(far - i * 7));
+        test.insert(K(far - i * 7), 0);
+    }
+    agree();
+    // erasing the outliers and every other dense key lets the leaves narrow again
+    for (auto k : std::vector<K>(a.begin(), a.end())) {
+        if (k % 2 || k > 4000) {
+            ASSERT(test.erase(k) == 1);
+            a.erase(k);
+        }
+    }
+    agree();
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    std::mt19937_64 engine(seed);
+    // sparse keys over the whole range, including both signs
+    check<int, 6>([&] { return int(engine()); });
+    check<long, 6>([&] { return long(engine()); });
+    check<short, 6>([&] { return short(engine()); });
+    // dense runs with occasional gaps
+    check<int, 6>([&] { return int(engine() % (LIMIT * 2)) - LIMIT; });
+    check<unsigned long, 32>([&] { return (engine() % 8 ? 0ul : ULONG_MAX - 3 * LIMIT) + engine() % (LIMIT * 3 / 2); });
+    check<long, 32>([&] { return long(engine() % 1000) * 100000 + long(engine() % 100); });
+    // interpolation inside wide nodes, on uniform, skewed and extreme keys
+    check<int, 128, InterpolationSearch>([&] { return int(engine()); });
+    check<long, 64, InterpolationSearch>([&] { return long(engine() % 1000) * long(engine() % 1000) * long(engine() % 1000); });
+    check<unsigned long, 32, InterpolationSearch>([&] { return (engine() % 8 ? 0ul : ULONG_MAX - 3 * LIMIT) + engine() % (LIMIT * 3 / 2); });
+    check<short, 6, InterpolationSearch>([&] { return short(engine()); });
+    check<double, 64, InterpolationSearch>([&] { return double(engine() % 100000) / 3; });
+    check<int, 256, LinearSearch>([&] { return int(engine() % (LIMIT * 2)) - LIMIT; });
+    switching<short>();
+    switching<int>();
+    switching<unsigned long>();
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <vector>
+#include <random>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void compare(Tree &test, Map &a, typename Map::key_type k) {
+    auto iter = test.find(k);
+    auto expected = a.find(k);
+    ASSERT(test.member(k) == (expected != a.end()));
+    if (expected == a.end()) {
+        ASSERT(!(iter != test.end()));
+    } else {
+        ASSERT(iter != test.end());
+        ASSERT((*iter).first == k);
+        ASSERT((*iter).second == expected->second);
+    }
+}
+
+template<typename K, typename Gen>
+void radix(unsigned bits, Gen gen) {
+    std::map<K, int> a;
+    BTree<K, int> test;
+    test.enable_radix(bits);
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+        compare(test, a, gen());
+        compare(test, a, k);
+    }
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    for (int i = 0; i < LIMIT / 2; ++i) {
+        auto k = gen();
+        auto iter = test.find(k);
+        if (iter != test.end()) {
+            test.erase(iter);
+            a.erase(k);
+        }
+        if (!a.empty() && rand() % 2) {
+            test.pop_min();
+            a.erase(a.begin());
+        }
+        compare(test, a, gen());
+    }
+    test.disable_radix();
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+}
+
+template<typename K, typename Gen>
+void learned(size_t error, Gen gen) {
+    std::map<K, int> a;
+    BTree<K, int> test;
+    test.build_learned_index(error);
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+    }
+    test.build_learned_index(error);
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    for (int i = 0; i < LIMIT; ++i) {
+        compare(test, a, gen());
+    }
+    // replacing values keeps the model, new keys and erasures drop it
+    for (auto &i : a) {
+        i.second = -i.second;
+        test.insert(i.first, i.second);
+    }
+    for (int i = 0; i < LIMIT / 4; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+        compare(test, a, gen());
+        if (!a.empty() && rand() % 2) {
+            test.pop_min();
+            a.erase(a.begin());
+        }
+        if (i % 1000 == 0) test.build_learned_index(error);
+        compare(test, a, k);
+    }
+    test.build_learned_index(error);
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    BTree<K, int> moved(std::move(test));
+    for (auto &i : a) {
+        compare(moved, a, i.first);
+    }
+    moved.drop_learned_index();
+    for (auto &i : a) {
+        compare(moved, a, i.first);
+    }
+}
+
+template<typename K, size_t Factor, typename Gen>
+void hashed(Gen gen) {
+    std::map<K, int> a;
+    BTree<K, int, true, Factor> test;
+    for (int i = 0; i < LIMIT / 4; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+    }
+    test.enable_hash_index();
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+        compare(test, a, gen());
+        compare(test, a, k);
+    }
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        auto iter = test.find(k);
+        if (iter != test.end()) {
+            test.erase(iter);
+            a.erase(k);
+        }
+        if (!a.empty() && rand() % 2) {
+            test.pop_max();
+            a.erase(std::prev(a.end()));
+        }
+        compare(test, a, gen());
+    }
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    test.disable_hash_index();
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+}
+
+template<typename K, typename Gen>
+void filtered(size_t bits, Gen gen) {
+    std::map<K, int> a;
+    BTree<K, int> test;
+    test.enable_bloom_filter(bits);
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+        compare(test, a, gen());
+        compare(test, a, k);
+    }
+    for (int i = 0; i < LIMIT * 2; ++i) {
+        auto k = gen();
+        auto iter = test.find(k);
+        if (iter != test.end()) {
+            test.erase(iter);
+            a.erase(k);
+        }
+        if (i % 3 == 0) {
+            k = gen();
+            a[k] = i;
+            test.insert(k, i);
+        }
+        compare(test, a, gen());
+    }
+    for (auto &i : a) {
+        compare(test, a, i.first);
+    }
+    while (!test.empty()) {
+        test.pop_min();
+        a.erase(a.begin());
+        compare(test, a, gen());
+    }
+    test.disable_bloom_filter();
+}
+
+template<typename K, typename Gen>
+void batched(size_t batch, Gen gen) {
+    std::map<K, int> a;
+    BTree<K, int> test;
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = gen();
+        a[k] = i;
+        test.insert(k, i);
+    }
+    for (int round = 0; round < 20; ++round) {
+        std::vector<K> query;
+        for (size_t i = 0; i < batch; ++i) {
+            query.push_back(rand() % 2 || a.empty() ? gen() : std::next(a.begin(), rand() % a.size())->first);
+        }
+        std::sort(query.begin(), query.end());
+        std::vector<typename BTree<K, int>::iterator> found;
+        test.find_sorted(query.begin(), query.end(), std::back_inserter(found));
+        ASSERT(found.size() == query.size());
+        for (size_t i = 0; i < batch; ++i) {
+            ASSERT(!(found[i] != test.find(query[i])));
+        }
+    }
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    std::mt19937_64 engine(seed);
+    radix<int>(8, [&] { return int(engine()); });
+    radix<int>(16, [&] { return int(engine() % 5000) - 2500; });
+    radix<long>(12, [&] { return long(engine()); });
+    radix<unsigned>(4, [&] { return unsigned(engine() % 100000); });
+    radix<short>(16, [&] { return short(engine()); });
+    learned<int>(16, [&] { return int(engine()); });
+    learned<int>(0, [&] { return int(engine() % 5000) - 2500; });
+    learned<long>(4, [&] { return long(engine()); });
+    learned<unsigned long>(64, [&] { return (engine() % 1000) * (engine() % 1000) * (engine() % 1000); });
+    learned<double>(8, [&] { return double(engine() % 100000) / 7; });
+    hashed<int, 6>([&] { return int(engine() % 50000); });
+    hashed<long, 32>([&] { return long(engine()); });
+    hashed<std::string, 6>([&] { return "key-" + std::to_string(engine() % 30000); });
+    filtered<int>(10, [&] { return int(engine() % 100000); });
+    filtered<long>(2, [&] { return long(engine()); });
+    filtered<std::string>(8, [&] { return std::to_string(engine() % 40000); });
+    batched<int>(1000, [&] { return int(engine() % 100000); });
+    batched<long>(10, [&] { return long(engine()); });
+    batched<std::string>(500, [&] { return std::to_string(engine() % 40000); });
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <fstream>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree_mmap.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+struct Point {
+    int x, y;
+
+    bool operator==(const Point &that) const {
+        return x == that.x && y == that.y;
+    }
+};
+
+template<typename V, typename Gen>
+void mapped(const std::string &path, size_t n, size_t fanout, Gen gen) {
+    std::map<long, V> a;
+    {
+        BTree<long, V> test;
+        for (size_t i = 0; i < n; ++i) {
+            auto k = long(rand() % (4 * n + 1)) - long(n);
+            test.insert(k, gen(k));
+            a[k] = gen(k);
+        }
+        ASSERT((MappedBTree<long, V>::write(test, path, fanout)));
+    }
+    MappedBTree<long, V> view(path);
+    ASSERT(view.good());
+    ASSERT(view.size() == a.size());
+    auto iter = a.begin();
+    for (auto i : view) {
+        ASSERT(i.first == iter->first);
+        ASSERT(i.second == iter->second);
+        ++iter;
+    }
+    for (long k = -long(n) - 2; k < long(3 * n) + 2; ++k) {
+        auto expected = a.lower_bound(k);
+        auto found = view.lower_bound(k);
+        if (expected == a.end()) {
+            ASSERT(found == view.end());
+        } else {
+            ASSERT(found != view.end() && (*found).first == expected->first);
+        }
+        ASSERT(view.member(k) == (a.count(k) == 1));
+        if (a.count(k)) ASSERT((*view.find(k)).second == a[k]);
+    }
+}
+
+// files cut short, of other types or not trees at all are refused
+void refused(const std::string &path) {
+    BTree<long, long> test;
+    for (long i = 0; i < LIMIT; ++i) test.insert(i, i);
+    ASSERT((MappedBTree<long, long>::write(test, path)));
+    ASSERT((MappedBTree<long, long>(path).good()));
+    ASSERT((!MappedBTree<long, int>(path).good()));
+    // an in-memory view skips the checksum, so the layout alone must hold: one level too many is refused
+    {
+        auto size = std::filesystem::file_size(path);
+        std::vector<uint64_t> image((size + 7) / 8);
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char *>(image.data()), size);
+        ASSERT((MappedBTree<long, long>(image.data(), size).good()));
+        uint32_t levels;
+        size_t at = 8 + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t); // after magic, sizes, count and fanout
+        std::memcpy(&levels, reinterpret_cast<char *>(image.data()) + at, sizeof(levels));
+        levels++;
+        std::memcpy(reinterpret_cast<char *>(image.data()) + at, &levels, sizeof(levels));
+        ASSERT((!MappedBTree<long, long>(image.data(), size).good()));
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 64);
+    ASSERT((!MappedBTree<long, long>(path).good()));
+    std::filesystem::resize_file(path, 16);
+    ASSERT((!MappedBTree<long, long>(path).good()));
+    ASSERT((!MappedBTree<long, long>(path + ".missing").good()));
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    auto path = (std::filesystem::temp_directory_path() / ("btree_mapped_" + std::to_string(seed))).string();
+    auto same = [](long k) { return k; };
+    auto point = [](long k) { return Point{int(k), int(-k)}; };
+    for (size_t n : {0, 1, 15, 16, 17, 300, LIMIT}) {
+        mapped<long>(path, n, 16, same);
+        mapped<Point>(path, n, 16, point);
+        mapped<long>(path, n, 512, same);
+    }
+    mapped<long>(path, 20 * LIMIT, 16, same);
+    refused(path);
+    std::filesystem::remove(path);
+    ASSERT(alive_node == 0);
+    return 0;
+}
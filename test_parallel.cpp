@@ -0,0 +1,106 @@
+#include <vector>
+#include <random>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+// every node holds B - 1 to 2B - 2 entries (but the root) and sits one level below its parent
+template<typename Tree, typename Map>
+void valid(Tree &test, Map &a, size_t factor) {
+    ASSERT(test.size() == a.size());
+    auto iter = a.begin();
+    for (auto i = test.begin(); i != test.end(); ++i) {
+        ASSERT((*i).first == iter->first);
+        ASSERT((*i).second == iter->second);
+        ++iter;
+        for (auto node = i.node; node->node_parent(); node = node->node_parent()) {
+            ASSERT(node->node_parent()->node_height() == node->node_height() + 1);
+            ASSERT(node->node_usage() >= factor - 1 && node->node_usage() <= 2 * factor - 2);
+            ASSERT(node->node_parent()->child_at(node->node_idx()) == node);
+        }
+    }
+}
+
+template<size_t Factor, typename Gen>
+void parallel(size_t existing, size_t batch, unsigned threads, Gen gen) {
+    std::map<long, long> a;
+    BTree<long, long, true, Factor> test;
+    for (size_t i = 0; i < existing; ++i) {
+        auto k = gen();
+        a[k] = k;
+        test.insert(k, k);
+    }
+    for (int round = 0; round < 3; ++round) {
+        std::vector<std::pair<long, long>> entries;
+        size_t fresh = 0;
+        for (size_t i = 0; i < batch; ++i) {
+            auto k = gen();
+            entries.emplace_back(k, -long(i));
+        }
+        for (auto &[k, v]: entries) {
+            fresh += !a.count(k);
+            a[k] = v;
+        }
+        ASSERT(test.insert_batch_parallel(entries, threads) == fresh);
+        valid(test, a, Factor);
+    }
+    // the grafted tree has to stay valid under the usual updates
+    for (size_t i = 0; i < existing; ++i) {
+        auto k = gen();
+        ASSERT(test.erase(k) == a.erase(k));
+    }
+    valid(test, a, Factor);
+    while (!test.empty()) {
+        test.pop_min();
+    }
+}
+
+template<typename Gen>
+void lookups(size_t n, unsigned threads, Gen gen) {
+    BTree<long, long> test;
+    for (size_t i = 0; i < n; ++i) {
+        auto k = gen();
+        test.insert(k, k);
+    }
+    WorkerPool pool(threads);
+    ASSERT(pool.size() == threads);
+    for (int round = 0; round < 3; ++round) {
+        std::vector<long> query;
+        for (size_t i = 0; i < n + round; ++i) {
+            query.push_back(gen());
+        }
+        std::vector<BTree<long, long>::iterator> found;
+        test.find_batch_parallel(query, found, pool);
+        ASSERT(found.size() == query.size());
+        for (size_t i = 0; i < query.size(); ++i) {
+            ASSERT(!(found[i] != test.find(query[i])));
+        }
+    }
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    std::mt19937_64 engine(seed);
+    parallel<6>(LIMIT, LIMIT, 4, [&] { return long(engine() % (LIMIT * 4)); });
+    parallel<6>(LIMIT, LIMIT * 4, 3, [&] { return long(engine() % (LIMIT * 8)); });
+    parallel<3>(LIMIT / 4, LIMIT, 8, [&] { return long(engine()); });
+    parallel<16>(LIMIT, LIMIT, 2, [&] { return long(engine() % LIMIT); });
+    parallel<6>(10, 100, 4, [&] { return long(engine() % 1000); });
+    parallel<6>(0, LIMIT, 4, [&] { return long(engine()); });
+    parallel<6>(LIMIT, LIMIT, 1, [&] { return long(engine()); });
+    lookups(LIMIT, 4, [&] { return long(engine() % (LIMIT * 2)); });
+    lookups(LIMIT, 1, [&] { return long(engine() % (LIMIT * 2)); });
+    lookups(3, 8, [&] { return long(engine() % 10); });
+    lookups(0, 2, [&] { return long(engine()); });
+    ASSERT(alive_node == 0);
+    return 0;
+}
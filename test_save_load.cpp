@@ -0,0 +1,254 @@
+#include <vector>
+#include <random>
+#include <sstream>
+#include <filesystem>
+#include <future>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <map>
+#include <fcntl.h>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void same(Tree &test, Map &a) {
+    ASSERT(test.size() == a.size());
+    auto iter = a.begin();
+    for (auto i : test) {
+        ASSERT(i.first == iter->first);
+        ASSERT(i.second == iter->second);
+        ++iter;
+    }
+}
+
+template<typename K, typename V, size_t Factor, typename Gen>
+void round_trip(size_t n, Gen gen) {
+    std::map<K, V> a;
+    BTree<K, V, BinarySearch, Factor> test;
+    for (size_t i = 0; i < n; ++i) {
+        auto [key, value] = gen(i);
+        test.insert(key, value);
+        a[key] = value;
+    }
+    std::stringstream image;
+    ASSERT(test.save(image));
+    auto loaded = decltype(test)::load(image);
+    ASSERT(loaded.has_value());
+    same(*loaded, a);
+    for (auto &i : a) ASSERT((*loaded->find(i.first)).second == i.second);
+
+    // anything cut off or flipped is refused
+    auto bytes = image.str();
+    if (!bytes.empty()) {
+        std::stringstream cut(bytes.substr(0, bytes.size() - 1));
+        ASSERT(!decltype(test)::load(cut));
+        auto flipped = bytes;
+        flipped[rand() % flipped.size()] ^= 0x20;
+        std::stringstream corrupt(flipped);
+        ASSERT(!decltype(test)::load(corrupt));
+        std::stringstream half(bytes.substr(0, bytes.size() / 2));
+        ASSERT(!decltype(test)::load(half));
+    }
+    // so is a header claiming more entries than any tree holds
+    {
+        std::string header(bytes, 0, 8);
+        codec<uint64_t>::put(header, UINT64_MAX);
+        codec<uint32_t>::put(header, __btree_impl::crc32(header.data(), header.size()));
+        std::stringstream endless(header);
+        ASSERT(!decltype(test)::load(endless));
+    }
+    // a chunk longer than any writer makes is refused before it is read
+    size_t header = 8 + sizeof(uint64_t) + sizeof(uint32_t);
+    if (bytes.size() > header) {
+        auto huge = bytes;
+        uint32_t length = UINT32_MAX;
+        std::memcpy(huge.data() + header, &length, sizeof(length));
+        std::stringstream oversized(huge);
+        ASSERT(!decltype(test)::load(oversized));
+    }
+}
+
+void through_fd() {
+    std::map<long, long> a;
+    BTree<long, long> test;
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = long(rand());
+        test.insert(k, -k);
+        a[k] = -k;
+    }
+    auto path = (std::filesystem::temp_directory_path() / ("btree_image_" + std::to_string(rand()))).string();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT(fd >= 0 && test.save(fd));
+    ::close(fd);
+    fd = ::open(path.c_str(), O_RDONLY);
+    auto loaded = BTree<long, long>::load(fd);
+    ::close(fd);
+    std::filesystem::remove(path);
+    ASSERT(loaded.has_value());
+    same(*loaded, a);
+    loaded->insert(-1, 1);
+    a[-1] = 1;
+    same(*loaded, a);
+}
+
+// rounds of changes, each written as a delta on the round before, and replayed on the base image
+template<size_t Factor>
+void checkpoints(size_t n, size_t changes) {
+    std::map<long, long> a;
+    BTree<long, long, BinarySearch, Factor> test;
+    for (size_t i = 0; i < n; ++i) {
+        auto k = long(rand() % (4 * n + 1));
+        test.insert(k, k);
+        a[k] = k;
+    }
+    std::stringstream base;
+    ASSERT(test.save(base));
+    std::vector<std::stringstream> deltas(8);
+    for (auto &delta : deltas) {
+        for (size_t i = 0; i < changes; ++i) {
+            auto k = long(rand() % (4 * n + 1));
+            if (rand() % 3 == 0) {
+                ASSERT(test.erase(k) == a.erase(k));
+            } else {
+                test.insert(k, -long(i));
+                a[k] = -long(i);
+            }
+        }
+        if (&delta == &deltas[4]) {
+            std::vector<std::pair<long, long>> batch;
+            for (int i = 0; i < 200; ++i) batch.emplace_back(rand() % (4 * n + 1), i), a[batch.back().first] = i;
+            test.insert_batch_parallel(batch, 2);
+        }
+        ASSERT(test.checkpoint(delta));
+        if (n >= LIMIT) ASSERT(delta.str().size() * 4 < base.str().size());
+    }
+    std::vector<std::istream *> chain;
+    for (auto &delta : deltas) chain.push_back(&delta);
+    auto loaded = decltype(test)::load(base, chain);
+    ASSERT(loaded.has_value());
+    same(*loaded, a);
+
+    // a chain with a delta missing, damaged or in front of the base it needs is refused
+    auto rewind = [&] {
+        base.clear(), base.seekg(0);
+        for (auto &delta : deltas) delta.clear(), delta.seekg(0);
+    };
+    rewind();
+    chain.erase(chain.begin() + 4);
+    ASSERT(!decltype(test)::load(base, chain));
+    rewind();
+    auto bytes = deltas[5].str();
+    bytes[sizeof(uint64_t) * 3 + rand() % (bytes.size() - sizeof(uint64_t) * 3)] ^= 0x20;
+    std::stringstream damaged(bytes);
+    chain.assign({&deltas[0], &deltas[1], &deltas[2], &deltas[3], &deltas[4], &damaged});
+    ASSERT(!decltype(test)::load(base, chain));
+
+    // a base with as many entries as the right one is not mistaken for it
+    if (n) {
+        rewind();
+        auto other = *decltype(test)::load(base);
+        auto key = (*other.begin()).first;
+        other.insert(key, key + 1);
+        std::stringstream impostor;
+        ASSERT(other.save(impostor));
+        chain.assign({&deltas[0]});
+        ASSERT(!decltype(test)::load(impostor, chain));
+    }
+
+    // the loaded tree goes on from the last delta
+    rewind();
+    chain.assign({&deltas[0]});
+    auto first = decltype(test)::load(base, chain);
+    std::stringstream after;
+    first->insert(-1, -1);
+    ASSERT(first->checkpoint(after));
+    chain.push_back(&after);
+    rewind();
+    auto again = decltype(test)::load(base, chain);
+    ASSERT(again.has_value() && again->size() == first->size() && (*again->find(-1)).second == -1);
+}
+
+// writes go on while the tree as it was is saved in the background
+void in_background() {
+    std::map<long, long> a;
+    BTree<long, long> test;
+    for (int i = 0; i < 5 * LIMIT; ++i) {
+        auto k = long(rand());
+        test.insert(k, k);
+        a[k] = k;
+    }
+    auto then = a;
+    auto path = (std::filesystem::temp_directory_path() / ("btree_async_" + std::to_string(rand()))).string();
+    auto done = test.checkpoint_async(path);
+    int writes = 0;
+    do {
+        auto k = long(rand() % LIMIT);
+        if (writes % 7 == 0) {
+            ASSERT(test.erase(a.begin()->first) == 1);
+            a.erase(a.begin());
+        } else if (writes % 3 == 0) {
+            ASSERT(test.erase(k) == a.erase(k));
+        } else {
+            test.insert(k, -writes);
+            a[k] = -writes;
+        }
+        writes++;
+    } while (done.wait_for(std::chrono::seconds(0)) != std::future_status::ready || writes < LIMIT);
+    ASSERT(done.get());
+    same(test, a);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    auto loaded = BTree<long, long>::load(fd);
+    ::close(fd);
+    std::filesystem::remove(path);
+    ASSERT(loaded.has_value());
+    same(*loaded, then);
+}
+
+// a finished background save holds nothing of the tree, so the tree may go before its future
+void future_outlives_tree() {
+    auto path = (std::filesystem::temp_directory_path() / ("btree_async_" + std::to_string(rand()))).string();
+    std::future<bool> done;
+    {
+        BTree<long, long> test;
+        for (long k = 0; k < LIMIT; ++k) test.insert(k, -k);
+        done = test.checkpoint_async(path);
+        done.wait();
+    }
+    ASSERT(done.get());
+    int fd = ::open(path.c_str(), O_RDONLY);
+    auto loaded = BTree<long, long>::load(fd);
+    ::close(fd);
+    std::filesystem::remove(path);
+    ASSERT(loaded.has_value() && loaded->size() == LIMIT);
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    auto numbers = [](size_t) { return std::pair<long, long>(rand(), rand()); };
+    auto strings = [](size_t i) {
+        return std::pair<std::string, std::string>(std::to_string(rand()), std::string(i % 23, 'x'));
+    };
+    for (size_t n : {0, 1, 5, 100, LIMIT, 5 * LIMIT}) {
+        round_trip<long, long, 6>(n, numbers);
+        round_trip<long, long, 3>(n, numbers);
+        round_trip<std::string, std::string, 6>(n / 4, strings);
+    }
+    through_fd();
+    in_background();
+    future_outlives_tree();
+    for (size_t n : {0, 100, LIMIT, 5 * LIMIT}) {
+        checkpoints<6>(n, n / 100);
+        checkpoints<3>(n, n / 100 + 1);
+    }
+    std::stringstream garbage("not a tree image at all");
+    ASSERT((!BTree<long, long>::load(garbage)));
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <vector>
+#include <random>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <map>
+#include <set>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void same(Tree &test, Map &a) {
+    ASSERT(test.size() == a.size());
+    auto iter = a.begin();
+    for (auto i : test) {
+        ASSERT(i.first == iter->first);
+        ASSERT(i.second == iter->second);
+        ++iter;
+    }
+    ASSERT(iter == a.end());
+}
+
+template<size_t Factor>
+void bulk(size_t n) {
+    std::map<int, int> a;
+    for (size_t i = 0; i < n; ++i) {
+        a[int(i * 3)] = int(i);
+    }
+    std::vector<std::pair<int, int>> sorted(a.begin(), a.end());
+    auto test = BTree<int, int, true, Factor>::from_sorted(sorted.begin(), sorted.end());
+    same(test, a);
+    // the built tree has to stay valid under the usual updates
+    for (size_t i = 0; i < n; ++i) {
+        auto k = rand() % int(3 * n + 1);
+        if (rand() % 2) {
+            a[k] = k;
+            test.insert(k, k);
+        } else {
+            auto iter = test.find(k);
+            ASSERT((iter != test.end()) == a.count(k));
+            if (iter != test.end()) {
+                test.erase(iter);
+                a.erase(k);
+            }
+        }
+    }
+    same(test, a);
+    while (!test.empty()) {
+        test.pop_min();
+    }
+}
+
+template<typename Gen>
+void operations(size_t n, size_t m, Gen gen) {
+    std::map<long, long> a, b;
+    BTree<long, long> x, y;
+    for (size_t i = 0; i < n; ++i) {
+        auto k = gen();
+        a[k] = k;
+        x.insert(k, k);
+    }
+    for (size_t i = 0; i < m; ++i) {
+        auto k = gen();
+        b[k] = -k;
+        y.insert(k, -k);
+    }
+    std::map<long, long> u = b, in, d;
+    for (auto &i : a) {
+        u[i.first] = i.second;
+        if (b.count(i.first)) in.insert(i);
+        else d.insert(i);
+    }
+    auto tu = x.merge_union(y);
+    auto ti = x.intersection(y);
+    auto td = x.difference(y);
+    same(tu, u);
+    same(ti, in);
+    same(td, d);
+    // and the other way around
+    std::map<long, long> rin, rd;
+    for (auto &i : b) {
+        if (a.count(i.first)) rin.insert(i);
+        else rd.insert(i);
+    }
+    auto ri = y.intersection(x);
+    auto rdt = y.difference(x);
+    same(ri, rin);
+    same(rdt, rd);
+}
+
+template<typename Gen>
+void seeks(size_t n, Gen gen) {
+    std::set<unsigned long> a;
+    BTree<unsigned long, int> test;
+    for (size_t i = 0; i < n; ++i) {
+        auto k = gen();
+        a.insert(k);
+        test.insert(k, 0);
+    }
+    auto iter = test.lower_bound(0);
+    ASSERT(!(iter != test.begin()));
+    for (int round = 0; round < 10; ++round) {
+        auto c = test.make_cursor();
+        auto expected = a.begin();
+        auto target = 0ul;
+        while (!c.at_end()) {
+            target += gen() % (n / 50 + 2);
+            c.seek(target);
+            if (*expected < target) {
+                expected = a.lower_bound(target);
+                auto found = test.lower_bound(target);
+                ASSERT(!(found != c.at));
+            }
+            ASSERT(c.at_end() == (expected == a.end()));
+            if (c.at_end()) break;
+            ASSERT(c.key() == *expected);
+            if (rand() % 2) {
+                c.next();
+                ++expected;
+            }
+        }
+    }
+}
+
+template<typename Gen>
+void leapfrog(std::vector<size_t> sizes, Gen gen) {
+    std::vector<std::set<unsigned long>> sets(sizes.size());
+    BTree<unsigned long, int> x;
+    BTree<unsigned long, long> y;
+    BTree<unsigned long, unsigned long> z;
+    for (size_t i = 0; i < sizes[0]; ++i) x.insert(*sets[0].insert(gen()).first, 1);
+    for (size_t i = 0; i < sizes[1]; ++i) y.insert(*sets[1].insert(gen()).first, 2);
+    for (size_t i = 0; i < sizes[2]; ++i) z.insert(*sets[2].insert(gen()).first, 3);
+    std::vector<unsigned long> expected, found;
+    for (auto k : sets[0]) {
+        if (sets[1].count(k) && sets[2].count(k)) expected.push_back(k);
+    }
+    auto cx = x.make_cursor();
+    auto cy = y.make_cursor();
+    auto cz = z.make_cursor();
+    leapfrog_intersect([&](unsigned long k, auto &a, auto &b, auto &c) {
+        ASSERT(a.value() == 1 && b.value() == 2 && c.value() == 3);
+        found.push_back(k);
+    }, cx, cy, cz);
+    ASSERT(found == expected);
+    // a single cursor enumerates its tree
+    found.clear();
+    auto cy2 = y.make_cursor();
+    leapfrog_intersect([&](unsigned long k, auto &) { found.push_back(k); }, cy2);
+    ASSERT(found.size() == y.size());
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    std::mt19937_64 engine(seed);
+    for (size_t n : {0, 1, 5, 10, 11, 12, 100, 1000, LIMIT}) {
+        bulk<3>(n);
+        bulk<6>(n);
+        bulk<32>(n);
+    }
+    operations(LIMIT, LIMIT, [&] { return long(engine() % (LIMIT * 2)); });
+    operations(LIMIT, 30, [&] { return long(engine() % (LIMIT * 2)); });
+    operations(10, LIMIT, [&] { return long(engine() % (LIMIT * 2)); });
+    operations(0, LIMIT, [&] { return long(engine()); });
+    operations(LIMIT, 0, [&] { return long(engine()); });
+    seeks(LIMIT, [&] { return engine() % (LIMIT * 10); });
+    seeks(100, [&] { return engine() % 1000; });
+    leapfrog({LIMIT, LIMIT, LIMIT}, [&] { return engine() % (LIMIT * 4); });
+    leapfrog({LIMIT, 100, LIMIT}, [&] { return engine() % (LIMIT * 2); });
+    leapfrog({0, LIMIT, LIMIT}, [&] { return engine() % LIMIT; });
+    ASSERT(alive_node == 0);
+    return 0;
+}
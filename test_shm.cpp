@@ -0,0 +1,94 @@
+#include <vector>
+#include <random>
+#include <sys/wait.h>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree_shm.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+// version v maps each key below LIMIT / 2 + v to v, so a reader that saw two versions at once would notice
+void forked(unsigned readers, long versions) {
+    SharedBTree<long, long> shared(MappedBTree<long, long>::file_size(LIMIT));
+    ASSERT(shared.good());
+    std::vector<pid_t> children;
+    for (unsigned r = 0; r < readers; ++r) {
+        auto pid = ::fork();
+        if (pid == 0) {
+            while (shared.generation() < uint64_t(versions)) {
+                shared.read([&](auto &view) {
+                    if (view.size() == 0) return 0;
+                    auto v = (*view.begin()).second;
+                    ASSERT(view.size() == size_t(LIMIT / 2 + v));
+                    for (auto i : view) ASSERT(i.second == v);
+                    for (long k = 0; k < LIMIT / 2 + v; k += 97) ASSERT(view.member(k));
+                    ASSERT(!view.member(LIMIT / 2 + v));
+                    return 0;
+                });
+            }
+            ::_exit(0);
+        }
+        ASSERT(pid > 0);
+        children.push_back(pid);
+    }
+    for (long v = 0; v < versions; ++v) {
+        BTree<long, long> tree;
+        for (long k = 0; k < LIMIT / 2 + v * (LIMIT / 2 / versions); ++k) tree.insert(k, v * (LIMIT / 2 / versions));
+        ASSERT(shared.publish(tree));
+    }
+    for (auto pid : children) {
+        int status = 0;
+        ASSERT(::waitpid(pid, &status, 0) == pid);
+        ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    ASSERT(shared.generation() == uint64_t(versions));
+}
+
+// a region opened by name sees what was published, and a tree that does not fit is refused
+void named() {
+    auto name = "/btree_shared_" + std::to_string(::getpid());
+    SharedBTree<long, long> writer(name, MappedBTree<long, long>::file_size(LIMIT));
+    ASSERT(writer.good());
+    std::map<long, long> a;
+    BTree<long, long> tree;
+    for (int i = 0; i < LIMIT / 2; ++i) {
+        auto k = long(rand());
+        tree.insert(k, -k);
+        a[k] = -k;
+    }
+    ASSERT(writer.publish(tree));
+    SharedBTree<long, long> reader(name);
+    ASSERT(reader.good());
+    ASSERT(reader.size() == a.size());
+    for (auto &i : a) ASSERT(reader.get(i.first) == i.second);
+    ASSERT(!reader.get(-1));
+    ASSERT((!SharedBTree<long, int>(name).good()));
+
+    BTree<long, long> big;
+    for (long k = 0; k < 2 * LIMIT; ++k) big.insert(k, k);
+    ASSERT(!writer.publish(big));
+    ASSERT(reader.size() == a.size());
+    tree.insert(-1, 1);
+    ASSERT(writer.publish(tree));
+    ASSERT(reader.get(-1) == 1);
+    ASSERT(writer.generation() == 2);
+
+    ASSERT((SharedBTree<long, long>::remove(name)));
+    ASSERT((!SharedBTree<long, long>(name).good()));
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    forked(3, 40);
+    forked(1, 10);
+    named();
+    ASSERT(alive_node == 0);
+    return 0;
+}
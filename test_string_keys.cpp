@@ -0,0 +1,148 @@
+#include <vector>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <set>
+#include <algorithm>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+std::string random_key() {
+    static const char *prefixes[] = {"", "a", "tenant/", "tenant/region-", "https://example.com/path/"};
+    std::string key = prefixes[rand() % 5];
+    auto len = rand() % 12;
+    for (int i = 0; i < len; ++i) {
+        key.push_back("ab/\x00\xff"[rand() % 5]);
+    }
+    return key;
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    {
+        std::set<std::string> a;
+        BTree<std::string, int> test;
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = random_key();
+            a.insert(k);
+            test.insert(k, i);
+        }
+        ASSERT(a.size() == test.size());
+        std::vector<std::string> b;
+        for (auto i : test) {
+            b.push_back(i.first);
+        }
+        ASSERT(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = random_key();
+            ASSERT(test.member(k) == a.count(k));
+        }
+        while (!test.empty()) {
+            auto k = test.min_key();
+            ASSERT(k == *a.begin());
+            a.erase(a.begin());
+            test.pop_min();
+            if (!a.empty()) {
+                ASSERT(test.member(*a.begin()));
+                ASSERT(!test.member(k));
+            }
+        }
+    }
+    {
+        // erasing in random order moves separators down into leaves with other prefixes
+        std::set<std::string> a;
+        BTree<std::string, int> test;
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = random_key();
+            a.insert(k);
+            test.insert(k, i);
+        }
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = random_key();
+            ASSERT(test.erase(k) == a.erase(k));
+            auto found = test.lower_bound(k);
+            auto expected = a.lower_bound(k);
+            ASSERT((found != test.end()) == (expected != a.end()));
+            if (expected != a.end()) ASSERT((*found).first == *expected);
+        }
+        ASSERT(a.size() == test.size());
+        std::vector<std::string> b;
+        for (auto i : test) {
+            b.push_back(i.first);
+        }
+        ASSERT(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+    }
+    {
+        // batches rewrite whole leaves, and sorted lookups compare against the keys where they are stored
+        std::set<std::string> a;
+        BTree<std::string, int> test;
+        WriteBatch<std::string, int> ops;
+        for (int round = 0; round < 50; ++round) {
+            for (int i = 0; i < LIMIT / 50; ++i) {
+                auto k = random_key();
+                if (rand() % 4) {
+                    ops.put(k, i);
+                    a.insert(k);
+                } else {
+                    ops.erase(k);
+                    a.erase(k);
+                }
+            }
+            test.apply(ops);
+            ASSERT(a.size() == test.size());
+        }
+        std::vector<std::string> query;
+        for (int i = 0; i < LIMIT; ++i) {
+            query.push_back(random_key());
+        }
+        std::sort(query.begin(), query.end());
+        std::vector<BTree<std::string, int>::iterator> found;
+        test.find_sorted(query.begin(), query.end(), std::back_inserter(found));
+        for (size_t i = 0; i < query.size(); ++i) {
+            ASSERT((found[i] != test.end()) == (a.count(query[i]) == 1));
+            if (found[i] != test.end()) ASSERT((*found[i]).first == query[i]);
+        }
+        std::vector<std::string> b;
+        for (auto i : test) {
+            b.push_back(i.first);
+        }
+        ASSERT(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+    }
+    {
+        // keys whose first 8 bytes agree, or that differ only by trailing NULs, tie on their cached words
+        std::set<std::string> a;
+        BTree<std::string, int> test;
+        auto tied = [] {
+            std::string key = rand() % 2 ? "abcdefgh" : "abc";
+            for (int i = rand() % 4; i > 0; --i) {
+                key.push_back("\0a\xff"[rand() % 3]);
+            }
+            return key;
+        };
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = tied();
+            if (rand() % 3) {
+                a.insert(k);
+                test.insert(k, i);
+            } else {
+                ASSERT(test.erase(k) == a.erase(k));
+            }
+            auto q = tied();
+            ASSERT(test.member(q) == a.count(q));
+            auto found = test.lower_bound(q);
+            auto expected = a.lower_bound(q);
+            ASSERT((found != test.end()) == (expected != a.end()));
+            if (expected != a.end()) ASSERT((*found).first == *expected);
+        }
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <vector>
+#include <random>
+#include <thread>
+#include <filesystem>
+#include <fstream>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree_wal.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void same(Tree &test, Map &a) {
+    ASSERT(test.size() == a.size());
+    test.read([&](auto &tree) {
+        auto iter = a.begin();
+        for (auto i : tree) {
+            ASSERT(i.first == iter->first);
+            ASSERT(i.second == iter->second);
+            ++iter;
+        }
+        return 0;
+    });
+}
+
+// several writers on disjoint keys, then a recovery from the log alone
+void recovery(const std::string &path, unsigned threads) {
+    std::vector<std::map<long, long>> parts(threads);
+    {
+        DurableBTree<long, long> test(path);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937_64 engine(t);
+                auto &a = parts[t];
+                for (int i = 0; i < LIMIT / 8; ++i) {
+                    auto k = long(engine() % (LIMIT / 2)) * threads + t;
+                    if (i % 50 == 0) {
+                        WriteBatch<long, long> batch;
+                        for (long j = 0; j < 8; ++j) {
+                            auto key = k + j * threads;
+                            if (j % 3) batch.put(key, -i), a[key] = -i;
+                            else batch.erase(key), a.erase(key);
+                        }
+                        test.apply(batch);
+                    } else if (i % 5 == 0) {
+                        ASSERT(test.erase(k) == a.erase(k));
+                    } else {
+                        test.insert(k, i);
+                        a[k] = i;
+                    }
+                }
+            });
+        }
+        for (auto &worker: workers) worker.join();
+        ASSERT(test.good());
+    }
+    std::map<long, long> a;
+    for (auto &part: parts) a.insert(part.begin(), part.end());
+    DurableBTree<long, long> test(path);
+    same(test, a);
+}
+
+// a crash in the middle of a record loses that record only
+void torn_tail(const std::string &path) {
+    std::map<std::string, std::string> a;
+    {
+        DurableBTree<std::string, std::string> test(path);
+        for (int i = 0; i < LIMIT / 4; ++i) {
+            auto k = std::to_string(rand() % (LIMIT / 8));
+            test.insert(k, std::string(i % 17, 'v'));
+            a[k] = std::string(i % 17, 'v');
+        }
+        test.insert("last", "lost");
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    {
+        DurableBTree<std::string, std::string> test(path);
+        same(test, a);
+        ASSERT(!test.get("last"));
+        test.insert("after", "kept");
+        a["after"] = "kept";
+    }
+    DurableBTree<std::string, std::string> test(path);
+    same(test, a);
+}
+
+// a compacted log is bulk-loaded, and writes after the compaction are replayed on top
+void compaction(const std::string &path) {
+    std::map<long, long> a;
+    {
+        DurableBTree<long, long> test(path);
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = long(rand() % (LIMIT / 2));
+            test.insert(k, i);
+            a[k] = i;
+        }
+        auto before = std::filesystem::file_size(path);
+        ASSERT(test.compact());
+        ASSERT(std::filesystem::file_size(path) < before);
+        for (int i = 0; i < LIMIT / 4; ++i) {
+            auto k = long(rand() % LIMIT);
+            if (i % 2) {
+                ASSERT(test.erase(k) == a.erase(k));
+            } else {
+                test.insert(k, -i);
+                a[k] = -i;
+            }
+        }
+    }
+    {
+        DurableBTree<long, long> test(path);
+        same(test, a);
+        ASSERT(test.compact());
+    }
+    DurableBTree<long, long> test(path);
+    same(test, a);
+}
+
+// writes that cannot be logged are reported and leave the tree alone
+void unloggable(const std::string &path) {
+    DurableBTree<long, long> test(path + "/missing/log");
+    ASSERT(!test.good());
+    ASSERT(!test.insert(1, 1));
+    ASSERT(!test.erase(1));
+    WriteBatch<long, long> batch;
+    batch.put(2, 2);
+    ASSERT(!test.apply(batch));
+    ASSERT(test.size() == 0);
+}
+
+// records appended to a failed log are dropped and stay failed after the log is reopened
+void failed_log(const std::string &path) {
+    WriteAheadLog log(path + "/missing/log");
+    ASSERT(!log.good());
+    std::vector<uint64_t> lost;
+    for (int i = 0; i < 1000; ++i) lost.push_back(log.append(std::string(1000, 'x')));
+    ASSERT(!log.commit(lost.back()));
+    ASSERT(log.open(path));
+    auto lsn = log.append("kept");
+    ASSERT(lsn > lost.back());
+    ASSERT(log.commit(lsn));
+    for (auto dropped: lost) ASSERT(!log.commit(dropped));
+    size_t records = 0;
+    WriteAheadLog::replay(path, [&](const char *, const char *) { records++; });
+    ASSERT(records == 1);
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    auto path = (std::filesystem::temp_directory_path() / ("btree_wal_" + std::to_string(seed))).string();
+    for (unsigned threads: {1u, 4u}) {
+        recovery(path, threads);
+        std::filesystem::remove(path);
+    }
+    torn_tail(path);
+    std::filesystem::remove(path);
+    compaction(path);
+    std::filesystem::remove(path);
+    unloggable(path);
+    failed_log(path);
+    std::filesystem::remove(path);
+    ASSERT(alive_node == 0);
+    return 0;
+}
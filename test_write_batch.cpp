@@ -0,0 +1,167 @@
+#include <vector>
+#include <random>
+#include <thread>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <btree.hpp>
+#include <map>
+
+#define LIMIT 20000
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void same(Tree &test, Map &a) {
+    ASSERT(test.size() == a.size());
+    auto iter = a.begin();
+    for (auto i : test) {
+        ASSERT(i.first == iter->first);
+        ASSERT(i.second == iter->second);
+        ++iter;
+    }
+}
+
+template<size_t Factor, typename Gen>
+void batches(size_t batch, int puts, Gen gen) {
+    std::map<long, long> a;
+    BTree<long, long, true, Factor> test;
+    WriteBatch<long, long> ops;
+    for (int round = 0; round < LIMIT / int(batch) + 1; ++round) {
+        size_t erased = 0;
+        std::map<long, std::optional<long>> last;
+        for (size_t i = 0; i < batch; ++i) {
+            auto k = gen();
+            if (rand() % 100 < puts) {
+                ops.put(k, long(i));
+                last[k] = long(i);
+            } else {
+                ops.erase(k);
+                last[k] = std::nullopt;
+            }
+        }
+        for (auto &[k, v] : last) {
+            if (v) {
+                a[k] = *v;
+            } else {
+                erased += a.erase(k);
+            }
+        }
+        ASSERT(ops.size() == batch);
+        ASSERT(test.apply(ops) == erased);
+        ASSERT(ops.empty());
+        same(test, a);
+    }
+    while (!a.empty()) {
+        ASSERT(test.erase(a.begin()->first) == 1);
+        ASSERT(test.erase(a.begin()->first) == 0);
+        a.erase(a.begin());
+    }
+    ASSERT(test.empty());
+}
+
+// lookups answered by the hash index and the Bloom filter follow leaves that a batch cut up and drained
+void accelerated() {
+    std::map<long, long> a;
+    BTree<long, long> test;
+    test.enable_hash_index();
+    test.enable_bloom_filter();
+    WriteBatch<long, long> ops;
+    for (long k = 0; k < LIMIT; k += 3) {
+        ops.put(k, k);
+        a[k] = k;
+    }
+    test.apply(ops);
+    for (long k = 0; k < LIMIT; k += 2) {
+        ops.erase(k);
+        a.erase(k);
+    }
+    test.apply(ops);
+    same(test, a);
+    for (long k = -1; k <= LIMIT; ++k) {
+        ASSERT(test.member(k) == a.count(k));
+        auto iter = test.find(k);
+        ASSERT((iter != test.end()) == a.count(k));
+    }
+}
+
+// batches that split and merge internal nodes keep the radix table pointing at live nodes
+void radix(std::mt19937_64 &engine) {
+    std::map<short, short> a;
+    BTree<short, short, BinarySearch, 4> test;
+    test.enable_radix(8);
+    for (int round = 0; round < 200; ++round) {
+        WriteBatch<short, short> ops;
+        for (int i = 0; i < 100; ++i) {
+            auto k = short(engine() % 4000);
+            if (int(engine() % 100) < 45 + round % 20) {
+                ops.put(k, short(i)), a[k] = short(i);
+            } else {
+                ops.erase(k), a.erase(k);
+            }
+        }
+        test.apply(ops);
+        for (int i = 0; i < 50; ++i) {
+            auto k = short(engine() % 4000);
+            ASSERT(test.member(k) == a.count(k));
+        }
+    }
+    same(test, a);
+}
+
+// optimistic readers never miss a key a batch leaves in place while the batch cuts its leaf up
+void optimistic(unsigned readers) {
+    BTree<long, long> test;
+    for (long k = 0; k < 200; ++k) test.insert(k * 256, k);
+    test.enable_optimistic_reads();
+    std::atomic<bool> stop = false;
+    std::atomic<long> gap = 0;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < readers; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 engine(t);
+            for (size_t i = 0; !stop.load(); ++i) {
+                // mostly the stable key closing the gap being filled, which ends up in the last leaf of a cut
+                auto k = i % 4 ? gap.load() + 256 : long(engine() % 200) * 256;
+                ASSERT(test.member(k));
+                auto found = test.lookup(k);
+                ASSERT(found && *found == k / 256);
+            }
+        });
+    }
+    std::mt19937_64 engine(readers);
+    for (int round = 0; round < 20000; ++round) {
+        // 120 keys between two stable ones, cutting their leaf into several, put and then erased again
+        auto base = long(engine() % 199) * 256;
+        gap.store(base);
+        WriteBatch<long, long> ops;
+        for (long j = 0; j < 120; ++j) ops.put(base + 1 + j, j);
+        test.apply(ops);
+        for (long j = 0; j < 120; ++j) ops.erase(base + 1 + j);
+        ASSERT(test.apply(ops) == 120);
+    }
+    stop = true;
+    for (auto &worker: workers) worker.join();
+    ASSERT(test.size() == 200);
+    test.disable_optimistic_reads();
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    std::mt19937_64 engine(seed);
+    batches<6>(1000, 70, [&] { return long(engine() % 10000); });
+    batches<6>(1, 60, [&] { return long(engine() % 1000); });
+    batches<3>(100, 50, [&] { return long(engine() % 2000); });
+    batches<32>(5000, 80, [&] { return long(engine()); });
+    // mostly erasures, so leaves keep underflowing
+    batches<6>(2000, 30, [&] { return long(engine() % 3000); });
+    accelerated();
+    radix(engine);
+    optimistic(3);
+    optimistic(1);
+    ASSERT(alive_node == 0);
+    return 0;
+}